@@ -0,0 +1,827 @@
+// Headless Tofu benchmark
+// Usage: tofu_bench [--steps N] [--min-time SEC] [--isa NAME] [--threads N] [--assembly NAME] [--temporal N] [--integrator NAME] [--material NAME] [--dt SEC] [--frame SEC] [--mu X] [--lambda X] [--kernel] [--bodies N] [--precision NAME] [--ordering NAME] [--cache] [--stats] [--mesh PATH] [--as-mesh] [--rest NAME] [--topology NAME] [--surface NAME] [WxLxH ...]
+// Reports steps/sec, ns per tetrahedron and per-phase time of Step + GetSurface
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "kernel.h"
+#include "mesh.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "tofu.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Same physics setup as the viewer
+const float BenchdL = 1.0f;
+const float BenchMu = 4.5f;
+const float BenchLambda = 3.5f;
+const float BenchDt = 1.0f / 60.0f / 5.0f * 0.5f;
+const float BenchRotateX = 22.5f;
+const float BenchRotateY = 10.0f;
+const float BenchRotateZ = 5.0f;
+// Lowest corner starts this high above the floor
+const float BenchDropHeight = 1.0f;
+// Re-drop the body (untimed) before the contact phase goes unstable
+const int BenchResetSteps = 500;
+const glm::vec3 BenchStartVelocity(0.0f, -3.0f, 0.0f);
+
+struct GridSize {
+    int W, L, H;
+};
+
+// Body of a run: a grid of boxes, or a mesh
+struct BenchBody {
+    std::string name;
+    GridSize size;
+    const model::TetMesh* mesh;  // null: the lattice of size
+};
+
+// 4x8x6 (960 tets) ... 128x128x64 (5.2M tets)
+const GridSize DefaultSweep[] = {
+    {4, 8, 6}, {8, 16, 12}, {16, 16, 16}, {32, 32, 32},
+    {64, 64, 64}, {128, 128, 64},
+};
+
+// Per-frame surface extraction, timed as the surface phase
+enum class BenchSurface {
+    Flat,  // GetSurface: 18 floats per triangle
+    Indexed,  // GetSurfacePositions: 3 floats per surface point, the triangles are indexed once
+};
+
+// Per-run settings from the command line
+struct BenchConfig {
+    model::SimdIsa isa;
+    model::ThreadPool* pool;
+    model::AssemblyMode assembly;
+    model::IntegratorMode integrator;
+    model::MaterialModel material;
+    model::PrecisionMode precision;
+    bool precision_label;  // --precision all: grid names carry the precision
+    model::PointOrdering ordering;
+    bool ordering_label;  // --ordering all: grid names carry the ordering
+    bool cache;  // count cache misses of Step
+    float dt;
+    float frame;  // > 0: Advance by frame per iteration instead of Step by dt
+    float mu;
+    float lambda;
+    int fixed_steps;
+    double min_time;
+    bool stats;  // Tofu::CollectStats
+    bool compact_rest;  // Tofu::CompactRest of lattices
+    bool implicit_topology;  // Tofu::ImplicitTopology of lattices
+    int temporal_steps;  // Tofu::TemporalSteps, 0: default
+    BenchSurface surface;
+};
+
+struct PhaseTime {
+    double clear;
+    double solve;
+    double update;
+    double surface;
+};
+
+// Hardware cache miss counters of the calling thread (Linux perf events): L1D read misses and
+// last-level read misses; the generic events have no L2, on most CPUs the last level is L3
+class CacheCounters {
+public:
+    static const int Num = 2;
+
+    CacheCounters() {
+        for (int c = 0; c < Num; ++c) {
+            fd[c] = -1;
+        }
+#ifdef __linux__
+        const uint64_t cache[Num] = {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL};
+        for (int c = 0; c < Num; ++c) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache[c] | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[c] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~CacheCounters() {
+#ifdef __linux__
+        for (int c = 0; c < Num; ++c) {
+            if (fd[c] >= 0) close(fd[c]);
+        }
+#endif
+    }
+
+    bool Available() const {
+        return fd[0] >= 0 && fd[1] >= 0;
+    }
+
+    void Start() {
+#ifdef __linux__
+        for (int c = 0; c < Num; ++c) {
+            if (fd[c] >= 0) ioctl(fd[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void Stop() {
+#ifdef __linux__
+        for (int c = 0; c < Num; ++c) {
+            if (fd[c] >= 0) ioctl(fd[c], PERF_EVENT_IOC_DISABLE, 0);
+        }
+#endif
+    }
+
+    // Misses counted while started, counter c
+    long long Read(int c) const {
+        long long value = 0;
+#ifdef __linux__
+        if (fd[c] >= 0 && read(fd[c], &value, sizeof(value)) != sizeof(value)) value = 0;
+#endif
+        return value;
+    }
+
+private:
+    int fd[Num];
+};
+
+inline double Seconds(Clock::time_point t0, Clock::time_point t1) {
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+bool ParseIsa(const char* arg, model::SimdIsa* isa) {
+    const model::SimdIsa all[] = {model::SimdIsa::Scalar, model::SimdIsa::Avx2, model::SimdIsa::Avx512};
+    for (model::SimdIsa candidate : all) {
+        if (std::strcmp(arg, model::SimdIsaName(candidate)) == 0) {
+            *isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseOrdering(const char* arg, model::PointOrdering* ordering) {
+    const model::PointOrdering all[] = {model::PointOrdering::Lattice, model::PointOrdering::Morton,
+                                        model::PointOrdering::Hilbert, model::PointOrdering::Rcm};
+    for (model::PointOrdering candidate : all) {
+        if (std::strcmp(arg, model::PointOrderingName(candidate)) == 0) {
+            *ordering = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseMaterial(const char* arg, model::MaterialModel* material) {
+    const model::MaterialModel all[] = {model::MaterialModel::StVK, model::MaterialModel::StableNeoHookean,
+                                        model::MaterialModel::Corotated, model::MaterialModel::Linear};
+    for (model::MaterialModel candidate : all) {
+        if (std::strcmp(arg, model::MaterialModelName(candidate)) == 0) {
+            *material = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* AssemblyName(model::AssemblyMode assembly) {
+    switch (assembly) {
+    case model::AssemblyMode::Gather: return "gather";
+    case model::AssemblyMode::Fused: return "fused";
+    case model::AssemblyMode::Temporal: return "temporal";
+    default: return "scatter";
+    }
+}
+
+const char* PrecisionName(model::PrecisionMode precision) {
+    switch (precision) {
+    case model::PrecisionMode::Mixed: return "mixed";
+    case model::PrecisionMode::Double: return "double";
+    default: return "float";
+    }
+}
+
+const char* IntegratorName(model::IntegratorMode integrator) {
+    switch (integrator) {
+    case model::IntegratorMode::Implicit: return "implicit";
+    case model::IntegratorMode::ImplicitMatrixFree: return "matrix-free";
+    case model::IntegratorMode::Projective: return "projective";
+    default: return "explicit";
+    }
+}
+
+bool ParseGrid(const char* arg, GridSize* size) {
+    return std::sscanf(arg, "%dx%dx%d", &size->W, &size->L, &size->H) == 3 &&
+           size->W > 0 && size->L > 0 && size->H > 0;
+}
+
+// Surface of a Tofu / Scene by config.surface into holder (flat) or positions (indexed)
+template <class Body>
+void ExtractSurface(Body& body, const BenchConfig& config, float* holder, float* positions) {
+    if (config.surface == BenchSurface::Indexed) {
+        body.GetSurfacePositions(positions);
+    } else {
+        body.GetSurface(holder);
+    }
+}
+
+// Physics settings of the command line
+void SetupBody(model::Tofu& tofu, const BenchConfig& config) {
+    tofu.Isa = config.isa;
+    tofu.Pool = config.pool;
+    tofu.Assembly = config.assembly;
+    if (config.temporal_steps > 0) tofu.TemporalSteps = config.temporal_steps;
+    tofu.Integrator = config.integrator;
+    tofu.Precision = config.precision;
+    tofu.Ordering = config.ordering;
+    tofu.StressMu = config.mu;
+    tofu.StressLambda = config.lambda;
+    tofu.Material = config.material;
+    tofu.StartVelocity = BenchStartVelocity;
+    tofu.CollectStats = config.stats;
+    tofu.CompactRest = tofu.CompactRest && config.compact_rest;
+    tofu.ImplicitTopology = tofu.ImplicitTopology && config.implicit_topology;
+}
+
+// Rest bounding box of a body
+void BodyBounds(const BenchBody& body, glm::vec3* lo, glm::vec3* hi) {
+    if (!body.mesh) {
+        *lo = glm::vec3(0.0f);
+        *hi = BenchdL * glm::vec3(body.size.W, body.size.L, body.size.H);
+        return;
+    }
+    *lo = glm::vec3(std::numeric_limits<float>::max());
+    *hi = -*lo;
+    for (const glm::vec3& p : body.mesh->points) {
+        *lo = glm::min(*lo, p);
+        *hi = glm::max(*hi, p);
+    }
+}
+
+std::unique_ptr<model::Tofu> MakeBody(const BenchBody& body, model::ThreadPool* pool) {
+    if (body.mesh) return std::unique_ptr<model::Tofu>(new model::Tofu(*body.mesh, pool));
+    return std::unique_ptr<model::Tofu>(new model::Tofu(BenchdL, body.size.W, body.size.L, body.size.H));
+}
+
+// Viewer rotation, lifted so that the lowest corner of the bounding box sits at BenchDropHeight
+void StartTransform(const BenchBody& body, glm::mat3* start_rotate, glm::vec3* start_move) {
+    glm::mat4 rotate = glm::rotate(glm::mat4(1.0f), glm::radians(BenchRotateX), glm::vec3(1.0f, 0.0f, 0.0f));
+    rotate = glm::rotate(rotate, glm::radians(BenchRotateY), glm::vec3(0.0f, 1.0f, 0.0f));
+    rotate = glm::rotate(rotate, glm::radians(BenchRotateZ), glm::vec3(0.0f, 0.0f, 1.0f));
+    *start_rotate = glm::mat3(rotate);
+
+    glm::vec3 lo, hi;
+    BodyBounds(body, &lo, &hi);
+    float min_y = std::numeric_limits<float>::max();
+    for (int c = 0; c < 8; ++c) {
+        glm::vec3 corner(c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 4 ? hi.z : lo.z);
+        min_y = glm::min(min_y, (*start_rotate * corner).y);
+    }
+    *start_move = glm::vec3(0.0f, BenchDropHeight - min_y, 0.0f);
+}
+
+void RunBench(const BenchBody& body, const BenchConfig& config) {
+    std::unique_ptr<model::Tofu> own_tofu = MakeBody(body, config.pool);
+    model::Tofu& tofu = *own_tofu;
+    SetupBody(tofu, config);
+    glm::mat3 start_rotate;
+    glm::vec3 start_move;
+    StartTransform(body, &start_rotate, &start_move);
+    tofu.Initialize(start_rotate, start_move);
+
+    std::unique_ptr<float[]> holder(new float[tofu.SurfaceHolderSize]);
+    std::unique_ptr<float[]> positions(new float[tofu.SurfacePositionHolderSize]);
+
+    // Warm up caches and page in buffers
+    tofu.Step(config.dt);
+    ExtractSurface(tofu, config, holder.get(), positions.get());
+
+    // Step only, GetSurface is left out
+    CacheCounters counters;
+    PhaseTime phase = {0.0, 0.0, 0.0, 0.0};
+    int steps = 0;
+    long long cg_iterations = 0;
+    long long substeps = 0;
+    int failed = 0;  // steps failing the health check
+    double total = 0.0;
+    double start_energy = 0.0;  // Stats.energy of the first step since the last drop
+    while (config.fixed_steps > 0 ? steps < config.fixed_steps : total < config.min_time) {
+        if (steps > 0 && steps % BenchResetSteps == 0) {
+            tofu.Initialize(start_rotate, start_move);
+        }
+        bool drop_start = steps % BenchResetSteps == 0;
+        // Temporal: a batch of steps per iteration, up to the next reset
+        int batch = 1;
+        if (config.assembly == model::AssemblyMode::Temporal && config.frame <= 0.0f) {
+            batch = std::min(tofu.TemporalSteps, BenchResetSteps - steps % BenchResetSteps);
+            if (config.fixed_steps > 0) batch = std::min(batch, config.fixed_steps - steps);
+        }
+        if (config.cache) counters.Start();
+        Clock::time_point t0 = Clock::now();
+        Clock::time_point t1 = t0;
+        Clock::time_point t2, t3;
+        if (config.frame > 0.0f) {
+            // Substeps of the frame are timed as solve
+            int frame_substeps = tofu.Advance(config.frame);
+            substeps += frame_substeps;
+            failed += frame_substeps == 0;
+            t2 = t3 = Clock::now();
+            cg_iterations += tofu.SolverIterations;
+        } else if (config.integrator != model::IntegratorMode::Explicit ||
+                   config.assembly == model::AssemblyMode::Fused ||
+                   config.assembly == model::AssemblyMode::Temporal) {
+            // One phase: assembly, CG and update (fused: the whole sweep) are timed as solve
+            failed += tofu.Step(config.dt, batch) != model::StepStatus::Ok;
+            t2 = t3 = Clock::now();
+            cg_iterations += tofu.SolverIterations;
+        } else {
+            tofu.ClearAcceleration();
+            t1 = Clock::now();
+            tofu.SolveElements();
+            t2 = Clock::now();
+            failed += tofu.UpdateParams(config.dt) != model::StepStatus::Ok;
+            t3 = Clock::now();
+        }
+        if (config.cache) counters.Stop();
+        ExtractSurface(tofu, config, holder.get(), positions.get());
+        Clock::time_point t4 = Clock::now();
+
+        phase.clear += Seconds(t0, t1);
+        phase.solve += Seconds(t1, t2);
+        phase.update += Seconds(t2, t3);
+        phase.surface += Seconds(t3, t4);
+        total += Seconds(t0, t4);
+        steps += batch;
+        if (drop_start) start_energy = tofu.Stats.energy;
+    }
+
+    // Checksum of the final surface, to spot numerical changes between builds
+    if (config.surface != BenchSurface::Flat) tofu.GetSurface(holder.get());
+    double checksum = 0.0;
+    for (int i = 0; i < tofu.SurfaceHolderSize; ++i) {
+        checksum += holder[i];
+    }
+
+    double step_time = (phase.clear + phase.solve + phase.update) / steps;
+    char grid[32];
+    std::snprintf(grid, sizeof(grid), "%s", body.name.c_str());
+    if (config.ordering_label) {
+        std::snprintf(grid + std::strlen(grid), sizeof(grid) - std::strlen(grid), ":%s",
+                      model::PointOrderingName(config.ordering));
+    }
+    if (config.precision_label) {
+        std::snprintf(grid + std::strlen(grid), sizeof(grid) - std::strlen(grid), ":%s",
+                      PrecisionName(config.precision));
+    }
+    std::printf("%-18s %10d %10d %7d %10.1f %9.2f %9.3f %9.3f %9.3f %9.3f %6.1f %6.1f %18.10e\n",
+                grid, tofu.TetrahedraNum, tofu.PointNum, steps,
+                1.0 / step_time,
+                step_time * 1e9 / tofu.TetrahedraNum,
+                phase.clear * 1e3 / steps,
+                phase.solve * 1e3 / steps,
+                phase.update * 1e3 / steps,
+                phase.surface * 1e3 / steps,
+                (double) cg_iterations / steps,
+                (double) substeps / steps,
+                checksum);
+    if (failed > 0) {
+        std::printf("  %d steps failed the health check\n", failed);
+    }
+    if (config.cache && counters.Available()) {
+        double tet_steps = (double) tofu.TetrahedraNum * steps;
+        std::printf("  cache misses per tet-step: L1D %.3f, last level %.4f\n",
+                    counters.Read(0) / tet_steps, counters.Read(1) / tet_steps);
+    } else if (config.cache) {
+        std::printf("  cache misses: no perf counters\n");
+    }
+    if (config.stats) {
+        const model::StepStats& stats = tofu.Stats;
+        std::printf("  energy %.6e (kinetic %.6e, elastic %.6e, potential %.6e), %+.3f%% since the drop\n",
+                    stats.energy, stats.kinetic, stats.elastic, stats.potential,
+                    100.0 * (stats.energy - start_energy) / std::fabs(start_energy));
+        std::printf("  momentum (%.6e, %.6e, %.6e), angular (%.6e, %.6e, %.6e)\n",
+                    stats.momentum.x, stats.momentum.y, stats.momentum.z,
+                    stats.angular_momentum.x, stats.angular_momentum.y, stats.angular_momentum.z);
+    }
+    std::fflush(stdout);
+}
+
+// body_num bodies cycling through sweep in one Scene, set side by side along x
+// Step (or Advance) of the whole scene is timed as solve
+void RunSceneBench(const std::vector<BenchBody>& sweep, int body_num, const BenchConfig& config) {
+    model::Scene scene(config.pool);
+    float x = 0.0f;
+    for (int i = 0; i < body_num; ++i) {
+        const BenchBody& body = sweep[i % sweep.size()];
+        glm::mat3 start_rotate;
+        glm::vec3 start_move;
+        StartTransform(body, &start_rotate, &start_move);
+        glm::vec3 lo, hi;
+        BodyBounds(body, &lo, &hi);
+        start_move.x = x - lo.x;
+        x += hi.x - lo.x + hi.y - lo.y + hi.z - lo.z + BenchdL;
+        if (body.mesh) {
+            SetupBody(scene.AddBody(*body.mesh, start_rotate, start_move), config);
+        } else {
+            SetupBody(scene.AddBody(BenchdL, body.size.W, body.size.L, body.size.H, start_rotate, start_move), config);
+        }
+    }
+    scene.Initialize();
+
+    std::unique_ptr<float[]> holder(new float[scene.SurfaceHolderSize]);
+    std::unique_ptr<float[]> positions(new float[scene.SurfacePositionHolderSize]);
+    scene.Step(config.dt);
+    ExtractSurface(scene, config, holder.get(), positions.get());
+
+    int steps = 0;
+    long long substeps = 0;
+    int failed = 0;  // steps with a body failing the health check
+    double solve = 0.0;
+    double surface = 0.0;
+    while (config.fixed_steps > 0 ? steps < config.fixed_steps : solve + surface < config.min_time) {
+        if (steps > 0 && steps % BenchResetSteps == 0) {
+            scene.Initialize();
+        }
+        Clock::time_point t0 = Clock::now();
+        if (config.frame > 0.0f) {
+            substeps += scene.Advance(config.frame);
+            failed += scene.FailedBodies > 0;
+        } else {
+            failed += scene.Step(config.dt) != model::StepStatus::Ok;
+        }
+        Clock::time_point t1 = Clock::now();
+        ExtractSurface(scene, config, holder.get(), positions.get());
+        Clock::time_point t2 = Clock::now();
+        solve += Seconds(t0, t1);
+        surface += Seconds(t1, t2);
+        ++steps;
+    }
+
+    if (config.surface != BenchSurface::Flat) scene.GetSurface(holder.get());
+    double checksum = 0.0;
+    for (int i = 0; i < scene.SurfaceHolderSize; ++i) {
+        checksum += holder[i];
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%d bodies", body_num);
+    std::printf("%-18s %10d %10d %7d %10.1f %9.2f %9.3f %9.3f %9.3f %9.3f %6.1f %6.1f %18.10e\n",
+                name, scene.TetrahedraNum, scene.PointNum, steps,
+                steps / solve,
+                solve * 1e9 / steps / scene.TetrahedraNum,
+                0.0,
+                solve * 1e3 / steps,
+                0.0,
+                surface * 1e3 / steps,
+                0.0,
+                (double) substeps / steps,
+                checksum);
+    if (failed > 0) {
+        std::printf("  %d steps failed the health check\n", failed);
+    }
+    std::fflush(stdout);
+}
+
+// Element kernel in isolation: ForceBlocks of every available ISA over
+// disjoint, randomly deformed tetrahedra (in cache, no scatter), without and with the energy
+const int KernelBenchTetrahedraNum = 1 << 16;
+
+void RunKernelBench(model::MaterialModel material, double min_time) {
+    const int tet_num = KernelBenchTetrahedraNum;
+    const int block_num = (tet_num + model::TetrahedraBlockSize - 1) / model::TetrahedraBlockSize;
+    model::AlignedArray<model::TetrahedraBlock> blocks;
+    blocks.Allocate(block_num);
+    model::AlignedArray<model::TetrahedraRest> block_rest;  // one per block, as on a mesh
+    block_rest.Allocate(block_num);
+    model::Vec3Array points;
+    points.Allocate(tet_num * 4);
+    model::AlignedArray<float> force;
+    force.Allocate((size_t) block_num * model::TetrahedraForceSize);
+
+    // Rest shape: corner tetrahedra, frame at m4 = origin is the identity
+    const glm::vec3 rest[4] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f),
+    };
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+    for (int b = 0; b < block_num; ++b) {
+        model::TetrahedraBlock& blk = blocks[b];
+        model::TetrahedraRest& blk_rest = block_rest[b];
+        blk.num = model::TetrahedraBlockSize;
+        blk.rest = b;
+        for (int lane = 0; lane < model::TetrahedraBlockSize; ++lane) {
+            int t = b * model::TetrahedraBlockSize + lane;
+            for (int node = 0; node < 4; ++node) {
+                blk.m[node][lane] = t * 4 + node;
+                points.Set(t * 4 + node, rest[node] + glm::vec3(noise(rng), noise(rng), noise(rng)));
+            }
+            blk_rest.SetInvR(lane, glm::mat3(1.0f));
+            blk_rest.SetNorm(0, lane, 0.5f * glm::cross(rest[1] - rest[0], rest[2] - rest[0]));
+            blk_rest.SetNorm(1, lane, 0.5f * glm::cross(rest[3] - rest[0], rest[1] - rest[0]));
+            blk_rest.SetNorm(2, lane, 0.5f * glm::cross(rest[2] - rest[0], rest[3] - rest[0]));
+        }
+    }
+
+    const model::SimdIsa all[] = {model::SimdIsa::Scalar, model::SimdIsa::Avx2, model::SimdIsa::Avx512};
+    std::printf("%-8s %10s %9s %9s %14s\n", "kernel", "tets", "ns/tet", "+energy", "energy");
+    for (model::SimdIsa isa : all) {
+        if (!model::SimdIsaAvailable(isa)) continue;
+        model::ForceBlocksFunc force_blocks = model::GetForceBlocks(isa, material);
+        double ns[2];
+        model::BlockStats stats;
+        for (int energy = 0; energy < 2; ++energy) {
+            model::KernelParams params = {BenchMu, BenchLambda, 100.0f, energy == 1};
+            stats = force_blocks(blocks.Get(), block_rest.Get(), 0, block_num, points, params, force.Get());
+
+            int rounds = 0;
+            double total = 0.0;
+            while (total < min_time) {
+                Clock::time_point t0 = Clock::now();
+                force_blocks(blocks.Get(), block_rest.Get(), 0, block_num, points, params, force.Get());
+                total += Seconds(t0, Clock::now());
+                ++rounds;
+            }
+            ns[energy] = total * 1e9 / rounds / tet_num;
+        }
+        std::printf("%-8s %10d %9.2f %9.2f %14.6e\n", model::SimdIsaName(isa), tet_num, ns[0], ns[1], stats.energy);
+    }
+}
+
+void PrintUsage(const char* name) {
+    std::cout << "Usage: " << name << " [--steps N] [--min-time SEC] [--isa NAME] [--threads N] [--assembly NAME] [--temporal N] [--integrator NAME] [--material NAME] [--dt SEC] [--frame SEC] [--mu X] [--lambda X] [--kernel] [--bodies N] [--precision NAME] [--ordering NAME] [--cache] [--stats] [--mesh PATH] [--as-mesh] [--rest NAME] [--topology NAME] [--surface NAME] [WxLxH ...]" << std::endl
+              << "  --steps N       run exactly N steps per grid" << std::endl
+              << "  --min-time SEC  run each grid for at least SEC seconds (default 1.0)" << std::endl
+              << "  --isa NAME      tetrahedra kernel: scalar, avx2, avx512 (default: best available)" << std::endl
+              << "  --threads N     worker threads incl. the caller (default: hardware threads)" << std::endl
+              << "  --assembly NAME force assembly: scatter, gather, fused, temporal (default scatter)" << std::endl
+              << "  --temporal N    steps per batch of --assembly temporal (default 4)" << std::endl
+              << "  --integrator NAME time integration: explicit, implicit, matrix-free, projective (default explicit)" << std::endl
+              << "  --material NAME constitutive model: stvk, neohookean, corotated, linear (default stvk)" << std::endl
+              << "  --dt SEC        time step (default 1/600)" << std::endl
+              << "  --frame SEC     advance by SEC per iteration in CFL-sized substeps, ignores --dt" << std::endl
+              << "  --mu X          Lame mu (default 4.5)" << std::endl
+              << "  --lambda X      Lame lambda (default 3.5)" << std::endl
+              << "  --bodies N      step N bodies cycling through the grid sizes (default 4x8x6) in one Scene" << std::endl
+              << "  --kernel        time the element kernel of each ISA in isolation" << std::endl
+              << "  --precision NAME explicit state: float, mixed, double, or all three per grid (default float)" << std::endl
+              << "  --ordering NAME point numbering: lattice, morton, hilbert, rcm, or all per grid (default lattice)" << std::endl
+              << "  --cache         count L1D / last-level read misses of Step (Linux perf events, calling thread)" << std::endl
+              << "  --stats         collect energy / momentum every step, print those of the last one" << std::endl
+              << "  --mesh PATH     add a TetGen (.node / .ele) or Gmsh 4 ASCII (.msh) mesh to the bodies" << std::endl
+              << "  --as-mesh       build the grids as meshes (BoxLatticeMesh), through the mesh constructor" << std::endl
+              << "  --rest NAME     lattice rest state: compact (one per block shape, default) or full (one per block)" << std::endl
+              << "  --topology NAME lattice connectivity: implicit (computed per block, default) or stored" << std::endl
+              << "  --surface NAME  per-step surface extraction: flat (GetSurface, default) or indexed (GetSurfacePositions)" << std::endl
+              << "  WxLxH           grid sizes in boxes (default sweep 4x8x6 ... 128x128x64)" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig config = {model::DetectSimdIsa(), nullptr, model::AssemblyMode::Scatter,
+                          model::IntegratorMode::Explicit, model::MaterialModel::StVK,
+                          model::PrecisionMode::Float, false, model::PointOrdering::Lattice, false, false, BenchDt, 0.0f, BenchMu, BenchLambda, 0, 1.0,
+                          false, true, true, 0, BenchSurface::Flat};
+    int thread_num = 0;
+    bool kernel_only = false;
+    int body_num = 0;
+    std::vector<GridSize> grids;
+    std::vector<std::string> mesh_paths;
+    bool as_mesh = false;
+
+    for (int i = 1; i < argc; ++i) {
+        GridSize size;
+        if (std::strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            config.fixed_steps = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            config.min_time = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_num = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--temporal") == 0 && i + 1 < argc) {
+            config.temporal_steps = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+            body_num = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--kernel") == 0) {
+            kernel_only = true;
+        } else if (std::strcmp(argv[i], "--cache") == 0) {
+            config.cache = true;
+        } else if (std::strcmp(argv[i], "--ordering") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "all") == 0) {
+                config.ordering_label = true;
+            } else if (!ParseOrdering(argv[i], &config.ordering)) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            mesh_paths.push_back(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rest") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "compact") == 0) {
+                config.compact_rest = true;
+            } else if (std::strcmp(argv[i], "full") == 0) {
+                config.compact_rest = false;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--topology") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "implicit") == 0) {
+                config.implicit_topology = true;
+            } else if (std::strcmp(argv[i], "stored") == 0) {
+                config.implicit_topology = false;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--surface") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "flat") == 0) {
+                config.surface = BenchSurface::Flat;
+            } else if (std::strcmp(argv[i], "indexed") == 0) {
+                config.surface = BenchSurface::Indexed;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--as-mesh") == 0) {
+            as_mesh = true;
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            config.stats = true;
+        } else if (std::strcmp(argv[i], "--assembly") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "scatter") == 0) {
+                config.assembly = model::AssemblyMode::Scatter;
+            } else if (std::strcmp(argv[i], "gather") == 0) {
+                config.assembly = model::AssemblyMode::Gather;
+            } else if (std::strcmp(argv[i], "fused") == 0) {
+                config.assembly = model::AssemblyMode::Fused;
+            } else if (std::strcmp(argv[i], "temporal") == 0) {
+                config.assembly = model::AssemblyMode::Temporal;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "all") == 0) {
+                config.precision_label = true;
+            } else if (std::strcmp(argv[i], "float") == 0) {
+                config.precision = model::PrecisionMode::Float;
+            } else if (std::strcmp(argv[i], "mixed") == 0) {
+                config.precision = model::PrecisionMode::Mixed;
+            } else if (std::strcmp(argv[i], "double") == 0) {
+                config.precision = model::PrecisionMode::Double;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--integrator") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "explicit") == 0) {
+                config.integrator = model::IntegratorMode::Explicit;
+            } else if (std::strcmp(argv[i], "implicit") == 0) {
+                config.integrator = model::IntegratorMode::Implicit;
+            } else if (std::strcmp(argv[i], "matrix-free") == 0) {
+                config.integrator = model::IntegratorMode::ImplicitMatrixFree;
+            } else if (std::strcmp(argv[i], "projective") == 0) {
+                config.integrator = model::IntegratorMode::Projective;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--material") == 0 && i + 1 < argc) {
+            if (!ParseMaterial(argv[++i], &config.material)) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--dt") == 0 && i + 1 < argc) {
+            config.dt = (float) std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frame") == 0 && i + 1 < argc) {
+            config.frame = (float) std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--mu") == 0 && i + 1 < argc) {
+            config.mu = (float) std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--lambda") == 0 && i + 1 < argc) {
+            config.lambda = (float) std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            if (!ParseIsa(argv[++i], &config.isa) || !model::SimdIsaAvailable(config.isa)) {
+                std::cout << "ISA " << argv[i] << " not available" << std::endl;
+                return 1;
+            }
+        } else if (ParseGrid(argv[i], &size)) {
+            grids.push_back(size);
+        } else {
+            PrintUsage(argv[0]);
+            return argv[i][0] == '-' && argv[i][1] == 'h' ? 0 : 1;
+        }
+    }
+    if (kernel_only) {
+        RunKernelBench(config.material, config.min_time);
+        return 0;
+    }
+    if (grids.empty() && mesh_paths.empty() && body_num > 0) {
+        grids.push_back(DefaultSweep[0]);
+    } else if (grids.empty() && mesh_paths.empty()) {
+        grids.assign(std::begin(DefaultSweep), std::end(DefaultSweep));
+    }
+
+    std::unique_ptr<model::ThreadPool> own_pool;
+    config.pool = &model::ThreadPool::Default();
+    if (thread_num > 0) {
+        own_pool.reset(new model::ThreadPool(thread_num));
+        config.pool = own_pool.get();
+    }
+
+    // Grids, then the meshes; --as-mesh grids are meshed here too
+    std::vector<model::TetMesh> meshes(mesh_paths.size() + (as_mesh ? grids.size() : 0));
+    std::vector<BenchBody> sweep;
+    for (size_t g = 0; g < grids.size(); ++g) {
+        const GridSize& size = grids[g];
+        char name[32];
+        std::snprintf(name, sizeof(name), as_mesh ? "%dx%dx%d:mesh" : "%dx%dx%d", size.W, size.L, size.H);
+        BenchBody body = {name, size, nullptr};
+        if (as_mesh) {
+            body.mesh = &meshes[mesh_paths.size() + g];
+            model::BoxLatticeMesh(BenchdL, size.W, size.L, size.H, meshes[mesh_paths.size() + g]);
+        }
+        sweep.push_back(body);
+    }
+    for (size_t m = 0; m < mesh_paths.size(); ++m) {
+        std::string error;
+        Clock::time_point t0 = Clock::now();
+        if (!model::LoadMesh(mesh_paths[m], *config.pool, meshes[m], &error)) {
+            std::cout << mesh_paths[m] << ": " << error << std::endl;
+            return 1;
+        }
+        std::printf("loaded %s: %zu points, %zu tets in %.3f s\n", mesh_paths[m].c_str(),
+                    meshes[m].points.size(), meshes[m].tetrahedra.size(), Seconds(t0, Clock::now()));
+        std::string name = mesh_paths[m].substr(mesh_paths[m].find_last_of('/') + 1);
+        BenchBody body = {name.substr(0, 18), GridSize{0, 0, 0}, &meshes[m]};
+        sweep.push_back(body);
+    }
+
+    std::cout << "isa: " << model::SimdIsaName(config.isa) << ", threads: " << config.pool->ThreadNum()
+              << ", assembly: " << AssemblyName(config.assembly)
+              << ", integrator: " << IntegratorName(config.integrator)
+              << ", material: " << model::MaterialModelName(config.material)
+              << ", precision: " << (config.precision_label ? "all" : PrecisionName(config.precision))
+              << ", ordering: " << (config.ordering_label ? "all" : model::PointOrderingName(config.ordering))
+              << ", " << (config.frame > 0.0f ? "frame: " : "dt: ")
+              << (config.frame > 0.0f ? config.frame : config.dt) << std::endl;
+    // Per-step phase times in ms; ns/tet covers Step only (no GetSurface); cg: CG iterations per step
+    // With --frame a step is one Advance; sub: substeps per frame
+    std::printf("%-18s %10s %10s %7s %10s %9s %9s %9s %9s %9s %6s %6s %18s\n",
+                "grid", "tets", "points", "steps", "steps/s", "ns/tet",
+                "clear", "solve", "update", "surface", "cg", "sub", "checksum");
+    if (body_num > 0) {
+        RunSceneBench(sweep, body_num, config);
+        return 0;
+    }
+    // --ordering all / --precision all: every combination per grid
+    std::vector<model::PointOrdering> orderings(1, config.ordering);
+    if (config.ordering_label) {
+        orderings = {model::PointOrdering::Lattice, model::PointOrdering::Morton,
+                     model::PointOrdering::Hilbert, model::PointOrdering::Rcm};
+    }
+    std::vector<model::PrecisionMode> precisions(1, config.precision);
+    if (config.precision_label) {
+        precisions = {model::PrecisionMode::Float, model::PrecisionMode::Mixed, model::PrecisionMode::Double};
+    }
+    for (const BenchBody& body : sweep) {
+        // A mesh keeps the numbering of its file
+        int ordering_num = body.mesh ? 1 : (int) orderings.size();
+        for (int o = 0; o < ordering_num; ++o) {
+            for (model::PrecisionMode precision : precisions) {
+                config.ordering = orderings[o];
+                config.precision = precision;
+                RunBench(body, config);
+            }
+        }
+    }
+    return 0;
+}
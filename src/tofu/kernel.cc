@@ -0,0 +1,234 @@
+#include "kernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace model {
+
+namespace {
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+// OS must save ymm / zmm state (XCR0) on top of the CPUID feature bits
+bool CpuSupports(SimdIsa isa) {
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    switch (isa) {
+    case SimdIsa::Avx2:
+        return (xcr0 & 0x6) == 0x6 && fma && (info[1] & (1 << 5)) != 0;
+    case SimdIsa::Avx512:
+        return (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0;
+    default:
+        return true;
+    }
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+bool CpuSupports(SimdIsa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+    case SimdIsa::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdIsa::Avx512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return true;
+    }
+}
+#else
+bool CpuSupports(SimdIsa isa) {
+    return isa == SimdIsa::Scalar;
+}
+#endif
+
+template <class T>
+inline void LoadTetrahedra(const TetrahedraBlock& blk, const TetrahedraRest& rest, int lane,
+                           const BasicVec3Array<T>& points, glm::vec<3, T> x[4], glm::vec3 norm[3]) {
+    for (int node = 0; node < 4; ++node) {
+        x[node] = points.Get(blk.m[node][lane]);
+    }
+    for (int face = 0; face < 3; ++face) {
+        norm[face] = rest.GetNorm(face, lane);
+    }
+}
+
+}  // namespace
+
+template <class Material, class T>
+BlockStats SolveBlocksScalar(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const BasicVec3Array<T>& points, const KernelParams& params,
+                             BasicVec3Array<T>& acceleration) {
+    glm::vec<3, T> x[4], f[4];
+    glm::vec3 norm[3];
+    float max_strain2 = 0.0f;
+    float energy = 0.0f;
+    for (int b = begin; b < end; ++b) {
+        const TetrahedraBlock& blk = blocks[b];
+        const TetrahedraRest& blk_rest = rest[blk.rest];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            LoadTetrahedra(blk, blk_rest, lane, points, x, norm);
+            max_strain2 = std::max(max_strain2, TetrahedraForce<Material>(x, blk_rest.GetInvR(lane), norm, params, f));
+            if (params.energy) energy += TetrahedraEnergy<Material>(x, blk_rest.GetInvR(lane), params);
+            for (int node = 0; node < 4; ++node) {
+                acceleration.Add(blk.m[node][lane], f[node]);
+            }
+        }
+    }
+    return {std::sqrt(max_strain2), energy};
+}
+
+template <class Material>
+BlockStats ForceBlocksScalar(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             float* force) {
+    glm::vec3 x[4], norm[3], f[4];
+    float max_strain2 = 0.0f;
+    float energy = 0.0f;
+    for (int b = begin; b < end; ++b) {
+        const TetrahedraBlock& blk = blocks[b];
+        const TetrahedraRest& blk_rest = rest[blk.rest];
+        float* blk_force = force + (size_t) b * TetrahedraForceSize;
+        // Padding lanes are never gathered
+        for (int lane = 0; lane < blk.num; ++lane) {
+            LoadTetrahedra(blk, blk_rest, lane, points, x, norm);
+            max_strain2 = std::max(max_strain2, TetrahedraForce<Material>(x, blk_rest.GetInvR(lane), norm, params, f));
+            if (params.energy) energy += TetrahedraEnergy<Material>(x, blk_rest.GetInvR(lane), params);
+            for (int node = 0; node < 4; ++node) {
+                blk_force[(node * 3) * TetrahedraBlockSize + lane] = f[node].x;
+                blk_force[(node * 3 + 1) * TetrahedraBlockSize + lane] = f[node].y;
+                blk_force[(node * 3 + 2) * TetrahedraBlockSize + lane] = f[node].z;
+            }
+        }
+    }
+    return {std::sqrt(max_strain2), energy};
+}
+
+#define TOFU_INSTANTIATE_SCALAR(M)                                                                            \
+    template BlockStats SolveBlocksScalar<M, float>(const TetrahedraBlock*, const TetrahedraRest*, int, int,  \
+                                                    const Vec3Array&, const KernelParams&, Vec3Array&);       \
+    template BlockStats SolveBlocksScalar<M, double>(const TetrahedraBlock*, const TetrahedraRest*, int, int, \
+                                                     const DVec3Array&, const KernelParams&, DVec3Array&);    \
+    template BlockStats ForceBlocksScalar<M>(const TetrahedraBlock*, const TetrahedraRest*, int, int,         \
+                                             const Vec3Array&, const KernelParams&, float*);
+TOFU_FOR_EACH_MATERIAL(TOFU_INSTANTIATE_SCALAR)
+#undef TOFU_INSTANTIATE_SCALAR
+
+namespace {
+
+template <class Material>
+SolveBlocksFunc SolveBlocksOf(SimdIsa isa) {
+    switch (isa) {
+#ifdef TOFU_HAVE_AVX2
+    case SimdIsa::Avx2:
+        return SolveBlocksAvx2<Material>;
+#endif
+#ifdef TOFU_HAVE_AVX512
+    case SimdIsa::Avx512:
+        return SolveBlocksAvx512<Material>;
+#endif
+    default:
+        return SolveBlocksScalar<Material, float>;
+    }
+}
+
+template <class Material>
+ForceBlocksFunc ForceBlocksOf(SimdIsa isa) {
+    switch (isa) {
+#ifdef TOFU_HAVE_AVX2
+    case SimdIsa::Avx2:
+        return ForceBlocksAvx2<Material>;
+#endif
+#ifdef TOFU_HAVE_AVX512
+    case SimdIsa::Avx512:
+        return ForceBlocksAvx512<Material>;
+#endif
+    default:
+        return ForceBlocksScalar<Material>;
+    }
+}
+
+}  // namespace
+
+SolveBlocksFunc GetSolveBlocks(SimdIsa isa, MaterialModel material) {
+    switch (material) {
+    case MaterialModel::StableNeoHookean:
+        return SolveBlocksOf<StableNeoHookeanMaterial>(isa);
+    case MaterialModel::Corotated:
+        return SolveBlocksOf<CorotatedMaterial>(isa);
+    case MaterialModel::Linear:
+        return SolveBlocksOf<LinearMaterial>(isa);
+    default:
+        return SolveBlocksOf<StvkMaterial>(isa);
+    }
+}
+
+SolveBlocksDoubleFunc GetSolveBlocksDouble(MaterialModel material) {
+    switch (material) {
+    case MaterialModel::StableNeoHookean:
+        return SolveBlocksScalar<StableNeoHookeanMaterial, double>;
+    case MaterialModel::Corotated:
+        return SolveBlocksScalar<CorotatedMaterial, double>;
+    case MaterialModel::Linear:
+        return SolveBlocksScalar<LinearMaterial, double>;
+    default:
+        return SolveBlocksScalar<StvkMaterial, double>;
+    }
+}
+
+ForceBlocksFunc GetForceBlocks(SimdIsa isa, MaterialModel material) {
+    switch (material) {
+    case MaterialModel::StableNeoHookean:
+        return ForceBlocksOf<StableNeoHookeanMaterial>(isa);
+    case MaterialModel::Corotated:
+        return ForceBlocksOf<CorotatedMaterial>(isa);
+    case MaterialModel::Linear:
+        return ForceBlocksOf<LinearMaterial>(isa);
+    default:
+        return ForceBlocksOf<StvkMaterial>(isa);
+    }
+}
+
+bool SimdIsaAvailable(SimdIsa isa) {
+    if (isa == SimdIsa::Scalar) return true;
+    return SolveBlocksOf<StvkMaterial>(isa) != SolveBlocksScalar<StvkMaterial, float> && CpuSupports(isa);
+}
+
+SimdIsa DetectSimdIsa() {
+    if (SimdIsaAvailable(SimdIsa::Avx512)) return SimdIsa::Avx512;
+    if (SimdIsaAvailable(SimdIsa::Avx2)) return SimdIsa::Avx2;
+    return SimdIsa::Scalar;
+}
+
+const char* SimdIsaName(SimdIsa isa) {
+    switch (isa) {
+    case SimdIsa::Avx2:
+        return "avx2";
+    case SimdIsa::Avx512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+const char* MaterialModelName(MaterialModel material) {
+    switch (material) {
+    case MaterialModel::StableNeoHookean:
+        return "neohookean";
+    case MaterialModel::Corotated:
+        return "corotated";
+    case MaterialModel::Linear:
+        return "linear";
+    default:
+        return "stvk";
+    }
+}
+
+}  // namespace model
@@ -0,0 +1,201 @@
+#ifndef KERNEL_H_
+#define KERNEL_H_
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include "linalg.h"
+#include "material.h"
+#include "soa.h"
+
+namespace model {
+
+// Instruction set used by the tetrahedra loop
+enum class SimdIsa {
+    Scalar,  // TetrahedraForce per tetrahedra, always available
+    Avx2,  // 8 lanes, AVX2 + FMA
+    Avx512,  // 16 lanes, AVX-512F
+};
+
+// Best ISA supported by both this build and the running CPU
+SimdIsa DetectSimdIsa();
+// Whether this build carries a kernel for isa and the running CPU supports it
+bool SimdIsaAvailable(SimdIsa isa);
+const char* SimdIsaName(SimdIsa isa);
+
+// Material / point constants read by the element kernels
+struct KernelParams {
+    float mu;
+    float lambda;
+    float inv_mass;
+    bool energy;  // also sum the elastic energy into BlockStats
+};
+
+// By-products of the element kernels over their blocks
+struct BlockStats {
+    float max_strain;  // largest strain norm sqrt(TetrahedraStrain2)
+    float energy;  // elastic energy over the point mass if params.energy, 0 otherwise
+};
+
+// 3 V of the rest tetrahedra, V = |det R| / 6: norm^* carries a factor 3, so the element forces
+// derive from the energy 3 V psi(F)
+inline float TetrahedraVolume3(const glm::mat3& inv_R) {
+    return 0.5f / std::fabs(glm::determinant(inv_R));
+}
+
+// Squared Green strain norm |F^T F - I|^2 / 4, the health measure of a tetrahedra
+template <class T>
+inline T TetrahedraStrain2(const glm::mat<3, 3, T>& F) {
+    glm::mat<3, 3, T> strain = T(0.5) * (glm::transpose(F) * F - glm::mat<3, 3, T>(T(1)));
+    return glm::dot(strain[0], strain[0]) + glm::dot(strain[1], strain[1]) + glm::dot(strain[2], strain[2]);
+}
+
+// Elastic acceleration of the 4 nodes of one tetrahedra, returns TetrahedraStrain2
+// x: positions of m1..m4, inv_R: rest R^-1 (frame at m4), norm: norm^* of faces opposite to m4, m3, m2
+// T: scalar type of x / f and the arithmetic, the rest state stays float
+// Pure function of its arguments: safe from any thread, keeps F / strain / stress in registers
+template <class Material, class T>
+inline float TetrahedraForce(const glm::vec<3, T> x[4], const glm::mat3& inv_R, const glm::vec3 norm[3],
+                            const KernelParams& params, glm::vec<3, T> f[4]) {
+    glm::mat<3, 3, T> D(x[0] - x[3], x[1] - x[3], x[2] - x[3]);
+    glm::mat<3, 3, T> F = D * glm::mat<3, 3, T>(inv_R);
+
+    // f = P * norm^* / mass; faces are closed, so f(m1) = -sum(f(m2..m4))
+    glm::mat<3, 3, T> P = Material::Piola(F, T(params.inv_mass * params.mu), T(params.inv_mass * params.lambda));
+    f[3] = P * glm::vec<3, T>(norm[0]);  // m4
+    f[2] = P * glm::vec<3, T>(norm[1]);  // m3
+    f[1] = P * glm::vec<3, T>(norm[2]);  // m2
+    f[0] = -(f[1] + f[2] + f[3]);  // m1
+    return (float) TetrahedraStrain2(F);
+}
+
+// Elastic energy of one tetrahedra over the point mass, the potential of TetrahedraForce
+template <class Material, class T>
+inline float TetrahedraEnergy(const glm::vec<3, T> x[4], const glm::mat3& inv_R, const KernelParams& params) {
+    glm::mat<3, 3, T> D(x[0] - x[3], x[1] - x[3], x[2] - x[3]);
+    return TetrahedraVolume3(inv_R) *
+           (float) Material::Energy(D * glm::mat<3, 3, T>(inv_R), T(params.inv_mass * params.mu),
+                                    T(params.inv_mass * params.lambda));
+}
+
+// Linearization point of one tetrahedra for TetrahedraStiffness / TetrahedraForceDifferential:
+// deformation gradient F and stress, so that -K is positive semi-definite and can drive
+// conjugate gradients, see Material::Linearize
+template <class Material>
+inline void TetrahedraLinearize(const glm::vec3 x[4], const glm::mat3& inv_R, const KernelParams& params,
+                                glm::mat3& F, glm::mat3& stress) {
+    glm::mat3 T(x[0] - x[3], x[1] - x[3], x[2] - x[3]);
+    Material::Linearize(T * inv_R, params.mu, params.lambda, F, stress);
+}
+
+// Jacobian of TetrahedraForce at (F, stress), K[a * 4 + b] = d f(a) / d x(b), a, b = m1..m4
+inline void TetrahedraStiffness(const glm::mat3& F, const glm::mat3& stress, const glm::mat3& inv_R,
+                                const glm::vec3 norm[3], const KernelParams& params, glm::mat3 K[16]) {
+    // dF = e(axis) grad(b)^T with grad = rows of R^-1 (m4 closes the sum), so with
+    // u = F norm(a), w = F grad(b): K(a, b) = (grad(b) . S norm(a)) I + mu w u^T + lambda u w^T + mu (norm(a) . grad(b)) F F^T
+    glm::mat3 inv_RT = glm::transpose(inv_R);
+    glm::vec3 grad[4] = {inv_RT[0], inv_RT[1], inv_RT[2], -(inv_RT[0] + inv_RT[1] + inv_RT[2])};
+    glm::vec3 g[4] = {-(norm[0] + norm[1] + norm[2]), norm[2], norm[1], norm[0]};
+    glm::mat3 FFT = F * glm::transpose(F);
+    glm::vec3 u[4], w[4], Sg[4];
+    for (int n = 0; n < 4; ++n) {
+        u[n] = F * g[n];
+        w[n] = F * grad[n];
+        Sg[n] = stress * g[n];
+    }
+    float mu = params.inv_mass * params.mu;
+    float lambda = params.inv_mass * params.lambda;
+    // K is symmetric, K(b, a) = K(a, b)^T
+    for (int a = 0; a < 4; ++a) {
+        for (int b = a; b < 4; ++b) {
+            float diag = params.inv_mass * glm::dot(grad[b], Sg[a]);
+            float geo = mu * glm::dot(g[a], grad[b]);
+            glm::mat3& k = K[a * 4 + b];
+            for (int c = 0; c < 3; ++c) {
+                for (int r = 0; r < 3; ++r) {
+                    k[c][r] = geo * FFT[c][r] + mu * u[a][c] * w[b][r] + lambda * w[b][c] * u[a][r];
+                }
+                k[c][c] += diag;
+            }
+            if (b != a) K[b * 4 + a] = glm::transpose(k);
+        }
+    }
+}
+
+// K dx of one tetrahedra at (F, stress) without forming K, df[a] = sum_b K(a, b) dx[b]
+inline void TetrahedraForceDifferential(const glm::vec3 dx[4], const glm::mat3& F, const glm::mat3& stress,
+                                        const glm::mat3& inv_R, const glm::vec3 norm[3],
+                                        const KernelParams& params, glm::vec3 df[4]) {
+    glm::mat3 dT(dx[0] - dx[3], dx[1] - dx[3], dx[2] - dx[3]);
+    glm::mat3 dF = dT * inv_R;
+    glm::mat3 dstrain = 0.5f * (glm::transpose(dF) * F + glm::transpose(F) * dF);
+    float dtr = dstrain[0][0] + dstrain[1][1] + dstrain[2][2];
+    glm::mat3 dstress = 2.0f * params.mu * dstrain + params.lambda * dtr * glm::mat3(1.0f);
+
+    glm::mat3 dP = params.inv_mass * (dF * stress + F * dstress);
+    df[3] = dP * norm[0];
+    df[2] = dP * norm[1];
+    df[1] = dP * norm[2];
+    df[0] = -(df[1] + df[2] + df[3]);
+}
+
+// Accumulate elastic acceleration of blocks [begin, end) into acceleration, rest: the rest state
+// array of TetrahedraBlock::rest
+// Lanes of a block are scattered in order, so tetrahedra may share points
+// Both kernels return the BlockStats of the blocks
+typedef BlockStats (*SolveBlocksFunc)(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                                     int begin, int end, const Vec3Array& points, const KernelParams& params,
+                                     Vec3Array& acceleration);
+
+// Elastic acceleration of every node of blocks [begin, end), no scatter
+// Block b writes force[b * TetrahedraForceSize + (node * 3 + axis) * 16 + lane]
+const int TetrahedraForceSize = 12 * TetrahedraBlockSize;
+typedef BlockStats (*ForceBlocksFunc)(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                                     int begin, int end, const Vec3Array& points, const KernelParams& params,
+                                     float* force);
+
+// SolveBlocksFunc on double positions and acceleration, PrecisionMode::Double
+typedef BlockStats (*SolveBlocksDoubleFunc)(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                                           int begin, int end, const DVec3Array& points, const KernelParams& params,
+                                           DVec3Array& acceleration);
+
+// Kernels of isa and material, the scalar kernels if isa is not compiled in
+SolveBlocksFunc GetSolveBlocks(SimdIsa isa, MaterialModel material);
+ForceBlocksFunc GetForceBlocks(SimdIsa isa, MaterialModel material);
+// Double kernels are scalar only
+SolveBlocksDoubleFunc GetSolveBlocksDouble(MaterialModel material);
+
+// Explicitly instantiated for TOFU_FOR_EACH_MATERIAL in the translation unit of each ISA
+// TetrahedraForce per lane; SolveBlocksScalar for float and double
+template <class Material, class T>
+BlockStats SolveBlocksScalar(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const BasicVec3Array<T>& points, const KernelParams& params,
+                             BasicVec3Array<T>& acceleration);
+template <class Material>
+BlockStats ForceBlocksScalar(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             float* force);
+
+#ifdef TOFU_HAVE_AVX2
+template <class Material>
+BlockStats SolveBlocksAvx2(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                           int begin, int end, const Vec3Array& points, const KernelParams& params,
+                           Vec3Array& acceleration);
+template <class Material>
+BlockStats ForceBlocksAvx2(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                           int begin, int end, const Vec3Array& points, const KernelParams& params,
+                           float* force);
+#endif
+#ifdef TOFU_HAVE_AVX512
+template <class Material>
+BlockStats SolveBlocksAvx512(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             Vec3Array& acceleration);
+template <class Material>
+BlockStats ForceBlocksAvx512(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             float* force);
+#endif
+
+}  // namespace model
+
+#endif  // KERNEL_H_
@@ -0,0 +1,4 @@
+// AVX2 + FMA tetrahedra kernel, built with -mavx2 -mfma (/arch:AVX2)
+#define TOFU_SOLVE_BLOCKS SolveBlocksAvx2
+#define TOFU_FORCE_BLOCKS ForceBlocksAvx2
+#include "kernel_simd.inl"
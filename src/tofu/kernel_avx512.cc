@@ -0,0 +1,4 @@
+// AVX-512F tetrahedra kernel, built with -mavx512f (/arch:AVX512)
+#define TOFU_SOLVE_BLOCKS SolveBlocksAvx512
+#define TOFU_FORCE_BLOCKS ForceBlocksAvx512
+#include "kernel_simd.inl"
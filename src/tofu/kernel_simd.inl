@@ -0,0 +1,207 @@
+// Vectorized tetrahedra kernel, one lane per tetrahedra of a TetrahedraBlock
+// Included by kernel_<isa>.cc, which is compiled with that ISA enabled
+// TOFU_SOLVE_BLOCKS, TOFU_FORCE_BLOCKS: names of the generated functions
+#include "kernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TOFU_PRAGMA_SIMD_MAX_STRAIN2 _Pragma("omp simd reduction(max:max_strain2)")
+#define TOFU_PRAGMA_SIMD_MAX_STRAIN2_ENERGY _Pragma("omp simd reduction(max:max_strain2) reduction(+:energy)")
+#else
+#define TOFU_PRAGMA_SIMD_MAX_STRAIN2
+#define TOFU_PRAGMA_SIMD_MAX_STRAIN2_ENERGY
+#endif
+
+namespace model {
+
+namespace {
+
+// Lane helpers of BlockForce, inlined into its simd loop; matrices are column-major float[9]
+
+// F = T * R^-1 of lane l, T = (x1 - x4, x2 - x4, x3 - x4)
+inline void LaneDeformation(const TetrahedraBlock& blk, const TetrahedraRest& rest,
+                            const float* px, const float* py, const float* pz, int l, float F[9]) {
+    int i1 = blk.m[0][l];
+    int i2 = blk.m[1][l];
+    int i3 = blk.m[2][l];
+    int i4 = blk.m[3][l];
+
+    float x4 = px[i4], y4 = py[i4], z4 = pz[i4];
+    float T[9] = {
+        px[i1] - x4, py[i1] - y4, pz[i1] - z4,
+        px[i2] - x4, py[i2] - y4, pz[i2] - z4,
+        px[i3] - x4, py[i3] - y4, pz[i3] - z4,
+    };
+    for (int c = 0; c < 3; ++c) {
+        float r0 = rest.inv_R[c * 3][l];
+        float r1 = rest.inv_R[c * 3 + 1][l];
+        float r2 = rest.inv_R[c * 3 + 2][l];
+        for (int r = 0; r < 3; ++r) {
+            F[c * 3 + r] = T[r] * r0 + T[3 + r] * r1 + T[6 + r] * r2;
+        }
+    }
+}
+
+// f = P * norm^*, node m4, m3, m2; m1 closes the sum
+inline void LaneNodeForce(const TetrahedraRest& rest, int l, const float P[9], float (*f)[TetrahedraBlockSize]) {
+    for (int r = 0; r < 3; ++r) {
+        float f4 = P[r] * rest.norm[0][l] + P[3 + r] * rest.norm[1][l] + P[6 + r] * rest.norm[2][l];
+        float f3 = P[r] * rest.norm[3][l] + P[3 + r] * rest.norm[4][l] + P[6 + r] * rest.norm[5][l];
+        float f2 = P[r] * rest.norm[6][l] + P[3 + r] * rest.norm[7][l] + P[6 + r] * rest.norm[8][l];
+        f[9 + r][l] = f4;
+        f[6 + r][l] = f3;
+        f[3 + r][l] = f2;
+        f[r][l] = -(f2 + f3 + f4);
+    }
+}
+
+// TetrahedraStrain2 of F
+inline float LaneStrain2(const float F[9]) {
+    float E00 = 0.5f * (F[0] * F[0] + F[1] * F[1] + F[2] * F[2] - 1.0f);
+    float E11 = 0.5f * (F[3] * F[3] + F[4] * F[4] + F[5] * F[5] - 1.0f);
+    float E22 = 0.5f * (F[6] * F[6] + F[7] * F[7] + F[8] * F[8] - 1.0f);
+    float E01 = 0.5f * (F[0] * F[3] + F[1] * F[4] + F[2] * F[5]);
+    float E02 = 0.5f * (F[0] * F[6] + F[1] * F[7] + F[2] * F[8]);
+    float E12 = 0.5f * (F[3] * F[6] + F[4] * F[7] + F[5] * F[8]);
+    return E00 * E00 + E11 * E11 + E22 * E22 + 2.0f * (E01 * E01 + E02 * E02 + E12 * E12);
+}
+
+// TetrahedraVolume3 of lane l
+inline float LaneVolume3(const TetrahedraRest& rest, int l) {
+    const float (*R)[TetrahedraBlockSize] = rest.inv_R;
+    float det = R[0][l] * (R[4][l] * R[8][l] - R[5][l] * R[7][l]) -
+                R[3][l] * (R[1][l] * R[8][l] - R[2][l] * R[7][l]) +
+                R[6][l] * (R[1][l] * R[5][l] - R[2][l] * R[4][l]);
+    return 0.5f / std::fabs(det);
+}
+
+// Force of lane l, mu and lambda over the point mass; returns LaneStrain2, energy: its
+// elastic energy (dropped by the caller that does not use it)
+template <class Material>
+inline float LaneForce(const TetrahedraBlock& blk, const TetrahedraRest& rest,
+                       const float* px, const float* py, const float* pz, int l, float mu, float lambda,
+                       float (*f)[TetrahedraBlockSize], float& energy) {
+    float F[9], P[9];
+    LaneDeformation(blk, rest, px, py, pz, l, F);
+    float psi = Material::LanePiola(F, mu, lambda, P);
+    LaneNodeForce(rest, l, P, f);
+    energy = LaneVolume3(rest, l) * psi;
+    return LaneStrain2(F);
+}
+
+// Elastic acceleration of the 4 nodes of every lane of blk, returns the largest LaneStrain2
+// f[node * 3 + axis][lane], node = m1, m2, m3, m4
+// Energy: add the elastic energy of the block to energy; a separate loop, so without it the
+// energy terms are never computed
+// Internal linkage: each ISA translation unit keeps its own copy
+// The simd loop only calls the lane function: arrays local to an omp simd body whose address
+// reaches a call become per-lane arrays in memory, the lane function keeps them in registers
+template <class Material, bool Energy>
+inline float BlockForce(const TetrahedraBlock& blk, const TetrahedraRest& rest, const Vec3Array& points,
+                        const KernelParams& params, float (*f)[TetrahedraBlockSize], float& energy) {
+    const int N = TetrahedraBlockSize;
+    const float* px = points.x;
+    const float* py = points.y;
+    const float* pz = points.z;
+    const float mu = params.inv_mass * params.mu;
+    const float lambda = params.inv_mass * params.lambda;
+
+    // Padding lanes (F = 0) are left out of the strain and energy
+    const int num = blk.num;
+    float max_strain2 = 0.0f;
+    if (Energy) {
+        TOFU_PRAGMA_SIMD_MAX_STRAIN2_ENERGY
+        for (int l = 0; l < N; ++l) {
+            float lane_energy;
+            float strain2 = LaneForce<Material>(blk, rest, px, py, pz, l, mu, lambda, f, lane_energy);
+            max_strain2 = std::max(max_strain2, l < num ? strain2 : 0.0f);
+            energy += l < num ? lane_energy : 0.0f;
+        }
+    } else {
+        TOFU_PRAGMA_SIMD_MAX_STRAIN2
+        for (int l = 0; l < N; ++l) {
+            float lane_energy;
+            float strain2 = LaneForce<Material>(blk, rest, px, py, pz, l, mu, lambda, f, lane_energy);
+            max_strain2 = std::max(max_strain2, l < num ? strain2 : 0.0f);
+        }
+    }
+    return max_strain2;
+}
+
+template <class Material, bool Energy>
+BlockStats SolveBlocks(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                       int begin, int end, const Vec3Array& points, const KernelParams& params,
+                       Vec3Array& acceleration) {
+    alignas(SoaAlignment) float f[12][TetrahedraBlockSize];
+    float* ax = acceleration.x;
+    float* ay = acceleration.y;
+    float* az = acceleration.z;
+    float max_strain2 = 0.0f;
+    float energy = 0.0f;
+
+    for (int b = begin; b < end; ++b) {
+        const TetrahedraBlock& blk = blocks[b];
+        float block_strain2 = BlockForce<Material, Energy>(blk, rest[blk.rest], points, params, f, energy);
+        max_strain2 = std::max(max_strain2, block_strain2);
+
+        // Scatter, lanes may share points
+        for (int l = 0; l < blk.num; ++l) {
+            for (int node = 0; node < 4; ++node) {
+                int m = blk.m[node][l];
+                ax[m] += f[node * 3][l];
+                ay[m] += f[node * 3 + 1][l];
+                az[m] += f[node * 3 + 2][l];
+            }
+        }
+    }
+    return {std::sqrt(max_strain2), energy};
+}
+
+template <class Material, bool Energy>
+BlockStats ForceBlocks(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                       int begin, int end, const Vec3Array& points, const KernelParams& params,
+                       float* force) {
+    float max_strain2 = 0.0f;
+    float energy = 0.0f;
+    for (int b = begin; b < end; ++b) {
+        float block_strain2 = BlockForce<Material, Energy>(
+            blocks[b], rest[blocks[b].rest], points, params,
+            reinterpret_cast<float (*)[TetrahedraBlockSize]>(force + (size_t) b * TetrahedraForceSize), energy);
+        max_strain2 = std::max(max_strain2, block_strain2);
+    }
+    return {std::sqrt(max_strain2), energy};
+}
+
+}  // namespace
+
+// Energy picked once per call, outside the block loop
+template <class Material>
+BlockStats TOFU_SOLVE_BLOCKS(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             Vec3Array& acceleration) {
+    return params.energy ? SolveBlocks<Material, true>(blocks, rest, begin, end, points, params, acceleration)
+                         : SolveBlocks<Material, false>(blocks, rest, begin, end, points, params, acceleration);
+}
+
+template <class Material>
+BlockStats TOFU_FORCE_BLOCKS(const TetrahedraBlock* blocks, const TetrahedraRest* rest,
+                             int begin, int end, const Vec3Array& points, const KernelParams& params,
+                             float* force) {
+    return params.energy ? ForceBlocks<Material, true>(blocks, rest, begin, end, points, params, force)
+                         : ForceBlocks<Material, false>(blocks, rest, begin, end, points, params, force);
+}
+
+#define TOFU_INSTANTIATE_SIMD(M)                                                                      \
+    template BlockStats TOFU_SOLVE_BLOCKS<M>(const TetrahedraBlock*, const TetrahedraRest*, int, int, \
+                                             const Vec3Array&, const KernelParams&, Vec3Array&);      \
+    template BlockStats TOFU_FORCE_BLOCKS<M>(const TetrahedraBlock*, const TetrahedraRest*, int, int, \
+                                             const Vec3Array&, const KernelParams&, float*);
+TOFU_FOR_EACH_MATERIAL(TOFU_INSTANTIATE_SIMD)
+#undef TOFU_INSTANTIATE_SIMD
+
+}  // namespace model
+
+#undef TOFU_PRAGMA_SIMD_MAX_STRAIN2
+#undef TOFU_PRAGMA_SIMD_MAX_STRAIN2_ENERGY
@@ -0,0 +1,304 @@
+#ifndef LINALG_H_
+#define LINALG_H_
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <glm/glm.hpp>
+
+// Full unroll of fixed-count loops, so that loops over tetrahedra around them vectorize
+#if defined(__GNUC__) || defined(__clang__)
+#define TOFU_PRAGMA_UNROLL _Pragma("GCC unroll 8")
+#else
+#define TOFU_PRAGMA_UNROLL
+#endif
+
+namespace model {
+
+// Smallest eigenvalue of symmetric S, closed form (Smith 1961)
+inline float MinEigenvalue(const glm::mat3& S) {
+    float p1 = S[1][0] * S[1][0] + S[2][0] * S[2][0] + S[2][1] * S[2][1];
+    float q = (S[0][0] + S[1][1] + S[2][2]) / 3.0f;
+    float d0 = S[0][0] - q;
+    float d1 = S[1][1] - q;
+    float d2 = S[2][2] - q;
+    float p2 = d0 * d0 + d1 * d1 + d2 * d2 + 2.0f * p1;
+    if (p2 <= 0.0f) return q;
+    float p = std::sqrt(p2 / 6.0f);
+    // r = det((S - q I) / p) / 2, in [-1, 1] up to rounding
+    float det = d0 * (d1 * d2 - S[2][1] * S[2][1]) - S[1][0] * (S[1][0] * d2 - S[2][1] * S[2][0]) +
+                S[2][0] * (S[1][0] * S[2][1] - d1 * S[2][0]);
+    float r = std::min(std::max(det / (2.0f * p * p * p), -1.0f), 1.0f);
+    float phi = std::acos(r) / 3.0f;
+    return q + 2.0f * p * std::cos(phi + 2.0943951f);  // + 2 pi / 3
+}
+
+// Symmetric S shifted by its smallest eigenvalue if that is negative, positive semi-definite
+inline glm::mat3 ShiftPositive(const glm::mat3& S) {
+    // Positive leading minors: positive definite, nothing to shift
+    float m1 = S[0][0];
+    float m2 = S[0][0] * S[1][1] - S[0][1] * S[0][1];
+    if (m1 > 0.0f && m2 > 0.0f && glm::determinant(S) > 0.0f) return S;
+    float lambda = MinEigenvalue(S);
+    return lambda < 0.0f ? S - lambda * glm::mat3(1.0f) : S;
+}
+
+// Eigen decomposition of symmetric S = Q diag(lambda) Q^T, cyclic Jacobi
+template <class T>
+inline void SymmetricEigen3(const glm::mat<3, 3, T>& S, glm::mat<3, 3, T>& Q, glm::vec<3, T>& lambda) {
+    const int SweepNum = 8;
+    T a[3][3] = {
+        {S[0][0], S[1][0], S[2][0]},
+        {S[1][0], S[1][1], S[2][1]},
+        {S[2][0], S[2][1], S[2][2]},
+    };
+    Q = glm::mat<3, 3, T>(T(1));
+    for (int sweep = 0; sweep < SweepNum; ++sweep) {
+        T off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        T diag = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+        if (off <= T(1e-12f) * diag) break;
+        for (int p = 0; p < 2; ++p) {
+            for (int q = p + 1; q < 3; ++q) {
+                T a_pq = a[p][q];
+                if (a_pq == T(0)) continue;
+                // Rotation in the (p, q) plane zeroing a(p, q)
+                T theta = (a[q][q] - a[p][p]) / (T(2) * a_pq);
+                T t = (theta >= T(0) ? T(1) : T(-1)) / (std::fabs(theta) + std::sqrt(theta * theta + T(1)));
+                T c = T(1) / std::sqrt(t * t + T(1));
+                T s = t * c;
+                int r = 3 - p - q;
+                T a_rp = a[r][p];
+                T a_rq = a[r][q];
+                a[r][p] = a[p][r] = c * a_rp - s * a_rq;
+                a[r][q] = a[q][r] = s * a_rp + c * a_rq;
+                a[p][p] -= t * a_pq;
+                a[q][q] += t * a_pq;
+                a[p][q] = a[q][p] = T(0);
+                for (int k = 0; k < 3; ++k) {
+                    T q_kp = Q[p][k];
+                    T q_kq = Q[q][k];
+                    Q[p][k] = c * q_kp - s * q_kq;
+                    Q[q][k] = s * q_kp + c * q_kq;
+                }
+            }
+        }
+    }
+    lambda = glm::vec<3, T>(a[0][0], a[1][1], a[2][2]);
+}
+
+// F = U diag(sigma) V^T with rotations U, V and sigma sorted by magnitude, descending
+// An inverted F (det < 0) gets a negative sigma[2] instead of a reflection in U or V
+template <class T>
+inline void Svd3(const glm::mat<3, 3, T>& F, glm::mat<3, 3, T>& U, glm::vec<3, T>& sigma, glm::mat<3, 3, T>& V) {
+    typedef glm::vec<3, T> Vec;
+    const T eps = T(1e-12f);
+    Vec lambda;
+    SymmetricEigen3(glm::transpose(F) * F, V, lambda);
+    // Sort descending, keep V a rotation
+    for (int i = 0; i < 2; ++i) {
+        for (int j = i + 1; j < 3; ++j) {
+            if (lambda[j] > lambda[i]) {
+                std::swap(lambda[i], lambda[j]);
+                std::swap(V[i], V[j]);
+            }
+        }
+    }
+    if (glm::determinant(V) < T(0)) V[2] = -V[2];
+
+    Vec Fv0 = F * V[0];
+    Vec Fv1 = F * V[1];
+    T len0 = glm::length(Fv0);
+    if (len0 < eps) {
+        U = glm::mat<3, 3, T>(T(1));
+        sigma = Vec(T(0));
+        return;
+    }
+    U[0] = Fv0 / len0;
+    Vec u1 = Fv1 - glm::dot(U[0], Fv1) * U[0];
+    T len1 = glm::length(u1);
+    if (len1 < eps) {
+        // Any unit vector orthogonal to u0
+        u1 = std::fabs(U[0].x) < T(0.9f) ? glm::cross(U[0], Vec(T(1), T(0), T(0)))
+                                          : glm::cross(U[0], Vec(T(0), T(1), T(0)));
+        len1 = glm::length(u1);
+    }
+    U[1] = u1 / len1;
+    U[2] = glm::cross(U[0], U[1]);
+    sigma = Vec(len0, glm::dot(U[1], Fv1), glm::dot(U[2], F * V[2]));
+}
+
+namespace svd3 {
+
+// Approximate Givens rotation of the (p, q) plane for the Jacobi sweeps of Svd3BranchFree:
+// (ch, sh) = (cos, sin) of half the angle zeroing s_pq, pi / 8 toward s_pq when that angle is too large
+inline void JacobiRotation(float s_pp, float s_qq, float s_pq, float& c, float& s) {
+    const float Gamma = 5.828427125f;  // 3 + 2 sqrt(2)
+    float ch = 2.0f * (s_pp - s_qq);
+    float sh = s_pq;
+    bool exact = Gamma * sh * sh < ch * ch;
+    float w = 1.0f / std::sqrt(ch * ch + sh * sh);
+    float s_star = sh < 0.0f ? -0.3826834324f : 0.3826834324f;
+    ch = exact ? w * ch : 0.9238795325f;
+    sh = exact ? w * sh : s_star;
+    c = ch * ch - sh * sh;
+    s = 2.0f * ch * sh;
+}
+
+// S <- G^T S G and V <- V G for the rotation G of the (p, q) plane, r the third axis
+inline void JacobiConjugate(float& s_pp, float& s_qq, float& s_pq, float& s_pr, float& s_qr,
+                            float* v_p, float* v_q) {
+    float c, s;
+    JacobiRotation(s_pp, s_qq, s_pq, c, s);
+    float pp = c * c * s_pp + 2.0f * c * s * s_pq + s * s * s_qq;
+    float qq = s * s * s_pp - 2.0f * c * s * s_pq + c * c * s_qq;
+    s_pq = (c * c - s * s) * s_pq + c * s * (s_qq - s_pp);
+    s_pp = pp;
+    s_qq = qq;
+    float pr = c * s_pr + s * s_qr;
+    s_qr = c * s_qr - s * s_pr;
+    s_pr = pr;
+    // Converged entries would underflow to denormals over the next sweeps, which cost
+    // several times the whole decomposition; exact zeros keep the rotations exact
+    const float Tiny = 1e-15f;
+    s_pq = std::fabs(s_pq) < Tiny ? 0.0f : s_pq;
+    s_pr = std::fabs(s_pr) < Tiny ? 0.0f : s_pr;
+    s_qr = std::fabs(s_qr) < Tiny ? 0.0f : s_qr;
+    for (int k = 0; k < 3; ++k) {
+        float vp = v_p[k];
+        v_p[k] = c * vp + s * v_q[k];
+        v_q[k] = c * v_q[k] - s * vp;
+    }
+}
+
+// Swap columns x, y when swap is set, negating one to keep the determinant
+inline void CondNegSwap(bool swap, float& x, float& y) {
+    float t = x;
+    x = swap ? y : x;
+    y = swap ? -t : y;
+}
+
+inline void CondNegSwap(bool swap, float* x, float* y) {
+    CondNegSwap(swap, x[0], y[0]);
+    CondNegSwap(swap, x[1], y[1]);
+    CondNegSwap(swap, x[2], y[2]);
+}
+
+inline void SetIdentity(float* M) {
+    M[0] = 1.0f, M[1] = 0.0f, M[2] = 0.0f;
+    M[3] = 0.0f, M[4] = 1.0f, M[5] = 0.0f;
+    M[6] = 0.0f, M[7] = 0.0f, M[8] = 1.0f;
+}
+
+// Exact Givens rotation zeroing entry q of column col of B (rows p, q), accumulated into U
+inline void QrRotate(float* B, float* U, int col, int p, int q) {
+    const float Eps = 1e-12f;
+    float a1 = B[col * 3 + p];
+    float a2 = B[col * 3 + q];
+    float rho = std::sqrt(a1 * a1 + a2 * a2);
+    float sh = rho > Eps ? a2 : 0.0f;
+    float ch = std::fabs(a1) + std::max(rho, Eps);
+    bool flip = a1 < 0.0f;
+    float t = sh;
+    sh = flip ? ch : sh;
+    ch = flip ? t : ch;
+    float w = 1.0f / std::sqrt(ch * ch + sh * sh);
+    ch *= w;
+    sh *= w;
+    float c = ch * ch - sh * sh;
+    float s = 2.0f * ch * sh;
+    for (int k = 0; k < 3; ++k) {
+        float bp = B[k * 3 + p];
+        B[k * 3 + p] = c * bp + s * B[k * 3 + q];
+        B[k * 3 + q] = c * B[k * 3 + q] - s * bp;
+    }
+    float* u_p = U + p * 3;
+    float* u_q = U + q * 3;
+    for (int k = 0; k < 3; ++k) {
+        float up = u_p[k];
+        u_p[k] = c * up + s * u_q[k];
+        u_q[k] = c * u_q[k] - s * up;
+    }
+}
+
+}  // namespace svd3
+
+// Svd3 for loops over tetrahedra that should vectorize
+// McAdams et al. 2011: fixed Jacobi sweeps on F^T F with approximate Givens rotations, column
+// sort and Givens QR of F V, all with selects instead of branches, so that a loop over
+// tetrahedra calling it vectorizes under omp simd. Matrices are column-major float[9]
+inline void Svd3BranchFree(const float F[9], float U[9], float sigma[3], float V[9]) {
+    const int SweepNum = 5;
+    // S = F^T F
+    float s00 = F[0] * F[0] + F[1] * F[1] + F[2] * F[2];
+    float s11 = F[3] * F[3] + F[4] * F[4] + F[5] * F[5];
+    float s22 = F[6] * F[6] + F[7] * F[7] + F[8] * F[8];
+    float s01 = F[0] * F[3] + F[1] * F[4] + F[2] * F[5];
+    float s02 = F[0] * F[6] + F[1] * F[7] + F[2] * F[8];
+    float s12 = F[3] * F[6] + F[4] * F[7] + F[5] * F[8];
+    svd3::SetIdentity(V);
+    TOFU_PRAGMA_UNROLL
+    for (int sweep = 0; sweep < SweepNum; ++sweep) {
+        svd3::JacobiConjugate(s00, s11, s01, s02, s12, V, V + 3);
+        svd3::JacobiConjugate(s00, s22, s02, s01, s12, V, V + 6);
+        svd3::JacobiConjugate(s11, s22, s12, s01, s02, V + 3, V + 6);
+    }
+
+    // B = F V, columns sorted by length
+    float B[9];
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            B[c * 3 + r] = F[r] * V[c * 3] + F[3 + r] * V[c * 3 + 1] + F[6 + r] * V[c * 3 + 2];
+        }
+    }
+    float rho0 = B[0] * B[0] + B[1] * B[1] + B[2] * B[2];
+    float rho1 = B[3] * B[3] + B[4] * B[4] + B[5] * B[5];
+    float rho2 = B[6] * B[6] + B[7] * B[7] + B[8] * B[8];
+    bool swap = rho0 < rho1;
+    svd3::CondNegSwap(swap, B, B + 3);
+    svd3::CondNegSwap(swap, V, V + 3);
+    float t = rho0;
+    rho0 = swap ? rho1 : rho0;
+    rho1 = swap ? t : rho1;
+    swap = rho0 < rho2;
+    svd3::CondNegSwap(swap, B, B + 6);
+    svd3::CondNegSwap(swap, V, V + 6);
+    rho2 = swap ? rho0 : rho2;
+    swap = rho1 < rho2;
+    svd3::CondNegSwap(swap, B + 3, B + 6);
+    svd3::CondNegSwap(swap, V + 3, V + 6);
+
+    // B = U diag(sigma)
+    svd3::SetIdentity(U);
+    svd3::QrRotate(B, U, 0, 0, 1);
+    svd3::QrRotate(B, U, 0, 0, 2);
+    svd3::QrRotate(B, U, 1, 1, 2);
+    sigma[0] = B[0];
+    sigma[1] = B[4];
+    sigma[2] = B[8];
+}
+
+// Rotation R of the polar decomposition F = R S, R = U V^T of the SVD
+// An inverted F still gives a rotation, the reflection stays in S
+// Branch free for simd loops, column-major float[9]
+inline void PolarRotation(const float F[9], float R[9]) {
+    float U[9], sigma[3], V[9];
+    Svd3BranchFree(F, U, sigma, V);
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            R[c * 3 + r] = U[r] * V[c] + U[3 + r] * V[3 + c] + U[6 + r] * V[6 + c];
+        }
+    }
+}
+
+// Scalar code: Svd3, which stops sweeping once converged
+template <class T>
+inline glm::mat<3, 3, T> PolarRotation(const glm::mat<3, 3, T>& F) {
+    glm::mat<3, 3, T> U, V;
+    glm::vec<3, T> sigma;
+    Svd3(F, U, sigma, V);
+    return U * glm::transpose(V);
+}
+
+}  // namespace model
+
+#endif  // LINALG_H_
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <memory>
 #include "ui.h"
+#include "scene.h"
 #include "shader.h"
 #include "tofu.h"
 
@@ -14,9 +15,11 @@ const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
 // Model
-model::Tofu* model_ptr = nullptr;
-int SimTimes = 5;  // Simulation times per frame
+model::Scene* scene_ptr = nullptr;
 float SlowMotionRatio = 0.5f;
+// Bodies in a row along x, SimBodySpacing apart
+int SimBodyNum = 1;
+float SimBodySpacing = 12.0f;
 
 // rotate x -> y -> z (degree)
 float SimRotateX = 22.5f;
@@ -128,26 +131,30 @@ void processInput(GLFWwindow* window) {
         }
     }
     if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-        model_ptr->Initialize(ModelStartRotate, ModelStartMove);
+        scene_ptr->Initialize();
     }
 }
 
 int main() {
     // Initialize model
-    std::unique_ptr<model::Tofu> model_obj(new model::Tofu(SimdL, SimW, SimH, SimL));
-    model_ptr = model_obj.get();
-    model_ptr->StressMu = SimMu;
-    model_ptr->StressLambda = SimLambda;
-    model_ptr->StartVelocity = ModelStartVelocity;
     glm::mat4 Rotate = glm::rotate(glm::mat4(1.0f), glm::radians(SimRotateX), glm::vec3(1.0f, 0.0f, 0.0f));
     Rotate = glm::rotate(Rotate, glm::radians(SimRotateY), glm::vec3(0.0f, 1.0f, 0.0f));
     ModelStartRotate = glm::rotate(Rotate, glm::radians(SimRotateZ), glm::vec3(0.0f, 0.0f, 1.0f));
-    model_ptr->Initialize(ModelStartRotate, ModelStartMove);
+    model::Scene scene_obj(&model::ThreadPool::Default());
+    scene_ptr = &scene_obj;
+    for (int i = 0; i < SimBodyNum; ++i) {
+        glm::vec3 move = ModelStartMove + glm::vec3(SimBodySpacing * (float) i, 0.0f, 0.0f);
+        model::Tofu& body = scene_ptr->AddBody(SimdL, SimW, SimH, SimL, ModelStartRotate, move);
+        body.StressMu = SimMu;
+        body.StressLambda = SimLambda;
+        body.StartVelocity = ModelStartVelocity;
+    }
+    scene_ptr->Initialize();
 
-    std::cout << "Box Number: " << model_ptr->BoxNum << std::endl;
-    std::cout << "Terahedra Number: " << model_ptr->TetrahedraNum << std::endl;
-    std::cout << "Surface Number: " << model_ptr->SurfaceNum << std::endl;
-    std::cout << "Point Number: " << model_ptr->PointNum << std::endl;
+    std::cout << "Body Number: " << scene_ptr->BodyNum() << std::endl;
+    std::cout << "Terahedra Number: " << scene_ptr->TetrahedraNum << std::endl;
+    std::cout << "Surface Number: " << scene_ptr->SurfaceNum << std::endl;
+    std::cout << "Point Number: " << scene_ptr->PointNum << std::endl;
 
     // glfw: initialize and configure
     // ------------------------------
@@ -189,44 +196,36 @@ int main() {
 
     render::ShaderProgram shader_prog("object.vs", "object.fs");
 
-    std::unique_ptr<float[]> holder_obj(new float[model_ptr->SurfaceHolderSize]);
-    // DEBUG Tetradedra
-    // std::unique_ptr<float[]> holder_obj(new float[model_ptr->TetrahedraHolderSize]);
+    // Indexed surface: the triangles go up once, the surface point positions every frame
+    const int index_num = 3 * scene_ptr->SurfaceNum;
+    std::unique_ptr<unsigned int[]> index_obj(new unsigned int[index_num]);
+    scene_ptr->GetSurfaceIndices(index_obj.get());
+    std::unique_ptr<float[]> holder_obj(new float[scene_ptr->SurfacePositionHolderSize]);
     float* holder = holder_obj.get();
-    model_ptr->GetSurface(holder);
-    // DEBUG Tetradedra
-    // model_ptr->GetTetrahedra(holder);
-    // for (int i = 0; i < model_ptr->SurfaceNum * 18; i += 6) {
-    //     std::cout << holder[i] << " "
-    //     << holder[i + 1] << " "
-    //     << holder[i + 2] << " "
-    //     << "," << " "
-    //     << holder[i + 3] << " "
-    //     << holder[i + 4] << " "
-    //     << holder[i + 5] << std::endl;
-    // }
+    scene_ptr->GetSurfacePositions(holder);
 
     unsigned int VBO[1];
+    unsigned int EBO[1];
     unsigned int VAO[1];
 
     glGenVertexArrays(1, VAO);
     glGenBuffers(1, VBO);
-
-    // push raw data into VBO
-    glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-    glBufferData(GL_ARRAY_BUFFER, model_ptr->SurfaceHolderSize * sizeof(float), holder, GL_DYNAMIC_DRAW);
-    // DEBUG Tetradedra
-    // glBufferData(GL_ARRAY_BUFFER, model_ptr->TetrahedraHolderSize * sizeof(float), holder, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, EBO);
 
     // setup data attribute
     glBindVertexArray(VAO[0]);
 
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    // push raw data into VBO
+    glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
+    glBufferData(GL_ARRAY_BUFFER, scene_ptr->SurfacePositionHolderSize * sizeof(float), holder, GL_DYNAMIC_DRAW);
+    // triangles, bound to the VAO
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[0]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_num * sizeof(unsigned int), index_obj.get(), GL_STATIC_DRAW);
+
+    // position attribute, the normal is computed per triangle by the fragment shader
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
-    // normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     // // render loop
@@ -242,14 +241,9 @@ int main() {
         processInput(window);
         
         // Simulate
-        float dt = deltaTime / (float) SimTimes * SlowMotionRatio;
-        // std::cout << "dT: " << dt << std::endl;
-        for (int sim_i = 0; sim_i < SimTimes; ++sim_i) {
-            model_ptr->Step(dt);
-        }
-        model_ptr->GetSurface(holder);
-        // DEBUG Tetradedra
-        // model_ptr->GetTetrahedra(holder);
+        // Substeps follow the material stiffness and element size, see Tofu::Advance
+        scene_ptr->Advance(deltaTime * SlowMotionRatio);
+        scene_ptr->GetSurfacePositions(holder);
 
         // Render
         // clear buffer
@@ -268,14 +262,10 @@ int main() {
 
         // enable attribute
         glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, model_ptr->SurfaceHolderSize * sizeof(float), holder);
-        // DEBUG Tetradedra
-        // glBufferSubData(GL_ARRAY_BUFFER, 0, model_ptr->TetrahedraHolderSize * sizeof(float), holder);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, scene_ptr->SurfacePositionHolderSize * sizeof(float), holder);
 
         glBindVertexArray(VAO[0]);
-        glDrawArrays(GL_TRIANGLES, /*first=*/0, /*count=*/model_ptr->SurfaceHolderSize);
-        // DEBUG Tetradedra
-        // glDrawArrays(GL_TRIANGLES, /*first=*/0, /*count=*/model_ptr->TetrahedraHolderSize);
+        glDrawElements(GL_TRIANGLES, /*count=*/index_num, GL_UNSIGNED_INT, /*indices=*/(void*)0);
         glBindVertexArray(0);
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -288,6 +278,7 @@ int main() {
     // ------------------------------------------------------------------------
     glDeleteVertexArrays(1, VAO);
     glDeleteBuffers(1, VBO);
+    glDeleteBuffers(1, EBO);
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
@@ -0,0 +1,223 @@
+#ifndef MATERIAL_H_
+#define MATERIAL_H_
+
+#include <glm/glm.hpp>
+#include "linalg.h"
+
+namespace model {
+
+// Constitutive models, selected at runtime among the explicit instantiations of the kernels
+enum class MaterialModel {
+    StVK,  // St. Venant-Kirchhoff: Green strain, stiffens under compression
+    StableNeoHookean,  // Smith et al. 2018: rest stable, resists inversion
+    Corotated,  // Corotational linear: linear strain in the frame of the polar rotation of F
+    Linear,  // Linear elasticity: small strain, not rotation invariant
+};
+
+const char* MaterialModelName(MaterialModel material);
+
+// Material policies of the element kernels, every member static and inlined into the element loop
+// Piola: first Piola-Kirchhoff stress P(F); P is linear in (mu, lambda), so the kernels fold the
+//   inverse point mass into them. Templated on the scalar type: float, double for
+//   PrecisionMode::Double
+// Energy: strain energy density psi(F), P = d psi / d F
+// LanePiola: P on column-major float[9], branch free for omp simd lanes; returns psi, which the
+//   compiler drops where it is not used
+// Linearize: (F, stress) of TetrahedraStiffness / TetrahedraForceDifferential, -K positive semi-definite
+
+// mu E : E + lambda / 2 tr(E)^2 for symmetric E
+template <class T>
+inline T StrainEnergy(const glm::mat<3, 3, T>& E, T mu, T lambda) {
+    T tr = E[0][0] + E[1][1] + E[2][2];
+    return mu * (glm::dot(E[0], E[0]) + glm::dot(E[1], E[1]) + glm::dot(E[2], E[2])) + T(0.5) * lambda * tr * tr;
+}
+
+// StrainEnergy on the 6 entries of a symmetric E
+inline float LaneStrainEnergy(float E00, float E11, float E22, float E01, float E02, float E12,
+                              float mu, float lambda) {
+    float tr = E00 + E11 + E22;
+    return mu * (E00 * E00 + E11 * E11 + E22 * E22 + 2.0f * (E01 * E01 + E02 * E02 + E12 * E12)) +
+           0.5f * lambda * tr * tr;
+}
+
+// P = A * (2 mu E + lambda tr(E) I) for symmetric E
+inline void LaneStress(const float A[9], float E00, float E11, float E22, float E01, float E02, float E12,
+                       float mu, float lambda, float P[9]) {
+    float two_mu = 2.0f * mu;
+    float tr = lambda * (E00 + E11 + E22);
+    float S[9] = {
+        two_mu * E00 + tr, two_mu * E01, two_mu * E02,
+        two_mu * E01, two_mu * E11 + tr, two_mu * E12,
+        two_mu * E02, two_mu * E12, two_mu * E22 + tr,
+    };
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            P[c * 3 + r] = A[r] * S[c * 3] + A[3 + r] * S[c * 3 + 1] + A[6 + r] * S[c * 3 + 2];
+        }
+    }
+}
+
+// P = F (2 mu E + lambda tr(E) I), E = (F^T F - I) / 2
+struct StvkMaterial {
+    template <class T>
+    static glm::mat<3, 3, T> Piola(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        const glm::mat<3, 3, T> I(T(1));
+        glm::mat<3, 3, T> strain = T(0.5) * (glm::transpose(F) * F - I);
+        T tr = strain[0][0] + strain[1][1] + strain[2][2];
+        return F * (T(2) * mu * strain + lambda * tr * I);
+    }
+
+    template <class T>
+    static T Energy(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        return StrainEnergy(T(0.5) * (glm::transpose(F) * F - glm::mat<3, 3, T>(T(1))), mu, lambda);
+    }
+
+    static float LanePiola(const float F[9], float mu, float lambda, float P[9]) {
+        float E00 = 0.5f * (F[0] * F[0] + F[1] * F[1] + F[2] * F[2] - 1.0f);
+        float E11 = 0.5f * (F[3] * F[3] + F[4] * F[4] + F[5] * F[5] - 1.0f);
+        float E22 = 0.5f * (F[6] * F[6] + F[7] * F[7] + F[8] * F[8] - 1.0f);
+        float E01 = 0.5f * (F[0] * F[3] + F[1] * F[4] + F[2] * F[5]);
+        float E02 = 0.5f * (F[0] * F[6] + F[1] * F[7] + F[2] * F[8]);
+        float E12 = 0.5f * (F[3] * F[6] + F[4] * F[7] + F[5] * F[8]);
+        LaneStress(F, E00, E11, E22, E01, E02, E12, mu, lambda, P);
+        return LaneStrainEnergy(E00, E11, E22, E01, E02, E12, mu, lambda);
+    }
+
+    // StVK under compression is not positive semi-definite, shift its stress
+    static void Linearize(const glm::mat3& F, float mu, float lambda, glm::mat3& F_lin, glm::mat3& stress) {
+        glm::mat3 strain = 0.5f * (glm::transpose(F) * F - glm::mat3(1.0f));
+        float tr = strain[0][0] + strain[1][1] + strain[2][2];
+        F_lin = F;
+        stress = ShiftPositive(2.0f * mu * strain + lambda * tr * glm::mat3(1.0f));
+    }
+};
+
+// P = mu F + (lambda' (J - 1) - mu) cof(F), J = det(F), lambda' = lambda + mu
+// Energy mu / 2 (tr(F^T F) - 3) + lambda' / 2 (J - 1 - mu / lambda')^2, shifted to 0 at rest:
+// P(I) = 0 and the Lame parameters at rest are (mu, lambda); finite under inversion (J <= 0)
+struct StableNeoHookeanMaterial {
+    template <class T>
+    static glm::mat<3, 3, T> Piola(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        glm::mat<3, 3, T> cof(glm::cross(F[1], F[2]), glm::cross(F[2], F[0]), glm::cross(F[0], F[1]));
+        T J = glm::dot(F[0], cof[0]);
+        return mu * F + ((lambda + mu) * (J - T(1)) - mu) * cof;
+    }
+
+    // mu / 2 (tr(F^T F) - 3) - mu (J - 1) + lambda' / 2 (J - 1)^2
+    template <class T>
+    static T Energy(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        T J = glm::determinant(F);
+        T ic = glm::dot(F[0], F[0]) + glm::dot(F[1], F[1]) + glm::dot(F[2], F[2]);
+        return T(0.5) * mu * (ic - T(3)) - mu * (J - T(1)) + T(0.5) * (lambda + mu) * (J - T(1)) * (J - T(1));
+    }
+
+    static float LanePiola(const float F[9], float mu, float lambda, float P[9]) {
+        float C[9] = {
+            F[4] * F[8] - F[5] * F[7], F[5] * F[6] - F[3] * F[8], F[3] * F[7] - F[4] * F[6],
+            F[7] * F[2] - F[8] * F[1], F[8] * F[0] - F[6] * F[2], F[6] * F[1] - F[7] * F[0],
+            F[1] * F[5] - F[2] * F[4], F[2] * F[3] - F[0] * F[5], F[0] * F[4] - F[1] * F[3],
+        };
+        float J = F[0] * C[0] + F[1] * C[1] + F[2] * C[2];
+        float s = (lambda + mu) * (J - 1.0f) - mu;
+        float ic = 0.0f;
+        for (int i = 0; i < 9; ++i) {
+            P[i] = mu * F[i] + s * C[i];
+            ic += F[i] * F[i];
+        }
+        return 0.5f * mu * (ic - 3.0f) - mu * (J - 1.0f) + 0.5f * (lambda + mu) * (J - 1.0f) * (J - 1.0f);
+    }
+
+    // Rest stiffness in the frame of the polar rotation, as Corotated: exact at rest and
+    // positive semi-definite everywhere
+    static void Linearize(const glm::mat3& F, float /*mu*/, float /*lambda*/, glm::mat3& F_lin, glm::mat3& stress) {
+        F_lin = PolarRotation(F);
+        stress = glm::mat3(0.0f);
+    }
+};
+
+// P = R (2 mu e + lambda tr(e) I), e = sym(R^T F) - I, F = R S polar; the rest stiffness
+// (R = I) applied in the frame of R, so large rotations cost no stiffening
+struct CorotatedMaterial {
+    template <class T>
+    static glm::mat<3, 3, T> Piola(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        const glm::mat<3, 3, T> I(T(1));
+        glm::mat<3, 3, T> R = PolarRotation(F);
+        glm::mat<3, 3, T> Y = glm::transpose(R) * F;
+        glm::mat<3, 3, T> strain = T(0.5) * (Y + glm::transpose(Y)) - I;
+        T tr = strain[0][0] + strain[1][1] + strain[2][2];
+        return R * (T(2) * mu * strain + lambda * tr * I);
+    }
+
+    template <class T>
+    static T Energy(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        glm::mat<3, 3, T> Y = glm::transpose(PolarRotation(F)) * F;
+        return StrainEnergy(T(0.5) * (Y + glm::transpose(Y)) - glm::mat<3, 3, T>(T(1)), mu, lambda);
+    }
+
+    // Svd3BranchFree: the polar rotation vectorizes with the rest of the lane
+    static float LanePiola(const float F[9], float mu, float lambda, float P[9]) {
+        float R[9], Y[9];
+        PolarRotation(F, R);
+        // strain = sym(R^T F) - I
+        for (int c = 0; c < 3; ++c) {
+            for (int r = 0; r < 3; ++r) {
+                Y[c * 3 + r] = R[r * 3] * F[c * 3] + R[r * 3 + 1] * F[c * 3 + 1] + R[r * 3 + 2] * F[c * 3 + 2];
+            }
+        }
+        float e00 = Y[0] - 1.0f, e11 = Y[4] - 1.0f, e22 = Y[8] - 1.0f;
+        float e01 = 0.5f * (Y[1] + Y[3]), e02 = 0.5f * (Y[2] + Y[6]), e12 = 0.5f * (Y[5] + Y[7]);
+        LaneStress(R, e00, e11, e22, e01, e02, e12, mu, lambda, P);
+        return LaneStrainEnergy(e00, e11, e22, e01, e02, e12, mu, lambda);
+    }
+
+    // The StVK terms at F = R, stress = 0 are exactly R K_rest R^T (rotation held fixed)
+    static void Linearize(const glm::mat3& F, float /*mu*/, float /*lambda*/, glm::mat3& F_lin, glm::mat3& stress) {
+        F_lin = PolarRotation(F);
+        stress = glm::mat3(0.0f);
+    }
+};
+
+// P = 2 mu e + lambda tr(e) I, e = sym(F) - I
+struct LinearMaterial {
+    template <class T>
+    static glm::mat<3, 3, T> Piola(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        const glm::mat<3, 3, T> I(T(1));
+        glm::mat<3, 3, T> strain = T(0.5) * (F + glm::transpose(F)) - I;
+        T tr = strain[0][0] + strain[1][1] + strain[2][2];
+        return T(2) * mu * strain + lambda * tr * I;
+    }
+
+    template <class T>
+    static T Energy(const glm::mat<3, 3, T>& F, T mu, T lambda) {
+        return StrainEnergy(T(0.5) * (F + glm::transpose(F)) - glm::mat<3, 3, T>(T(1)), mu, lambda);
+    }
+
+    static float LanePiola(const float F[9], float mu, float lambda, float P[9]) {
+        float tr = lambda * (F[0] + F[4] + F[8] - 3.0f);
+        P[0] = 2.0f * mu * (F[0] - 1.0f) + tr;
+        P[4] = 2.0f * mu * (F[4] - 1.0f) + tr;
+        P[8] = 2.0f * mu * (F[8] - 1.0f) + tr;
+        P[1] = P[3] = mu * (F[1] + F[3]);
+        P[2] = P[6] = mu * (F[2] + F[6]);
+        P[5] = P[7] = mu * (F[5] + F[7]);
+        return LaneStrainEnergy(F[0] - 1.0f, F[4] - 1.0f, F[8] - 1.0f, 0.5f * (F[1] + F[3]),
+                                0.5f * (F[2] + F[6]), 0.5f * (F[5] + F[7]), mu, lambda);
+    }
+
+    // K is the rest stiffness everywhere
+    static void Linearize(const glm::mat3& /*F*/, float /*mu*/, float /*lambda*/, glm::mat3& F_lin, glm::mat3& stress) {
+        F_lin = glm::mat3(1.0f);
+        stress = glm::mat3(0.0f);
+    }
+};
+
+// Every material policy, X(policy) per explicit instantiation
+#define TOFU_FOR_EACH_MATERIAL(X) \
+    X(StvkMaterial)               \
+    X(StableNeoHookeanMaterial)   \
+    X(CorotatedMaterial)          \
+    X(LinearMaterial)
+
+}  // namespace model
+
+#endif  // MATERIAL_H_
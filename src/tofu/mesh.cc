@@ -0,0 +1,515 @@
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace model {
+
+namespace {
+
+// Records per parallel parse chunk
+const int RecordGrain = 4096;
+// Bytes per line index chunk
+const size_t ScanBytes = 1 << 20;
+// Tetrahedra with |det(x1 - x4, x2 - x4, x3 - x4)| at most this times the cube of their longest
+// edge have no usable rest shape (a regular one has 1 / sqrt(2))
+const double DegenerateTetrahedra = 1e-6;
+
+// Read-only view of a whole file: mapped on POSIX, read into memory elsewhere
+class MappedFile {
+public:
+    MappedFile() : data(nullptr), size(0), map(nullptr) {}
+    ~MappedFile() {
+#ifndef _WIN32
+        if (map != nullptr) munmap(map, size);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t) st.st_size;
+        if (size > 0) {
+            map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) map = nullptr;
+        }
+        close(fd);
+        if (size > 0 && map == nullptr) return false;
+        if (map != nullptr) madvise(map, size, MADV_WILLNEED);
+        data = static_cast<const char*>(map);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return false;
+        size = (size_t) file.tellg();
+        buffer.resize(size);
+        file.seekg(0);
+        if (size > 0 && !file.read(buffer.data(), (std::streamsize) size)) return false;
+        data = buffer.data();
+        return true;
+#endif
+    }
+
+    const char* Data() const { return data; }
+    const char* End() const { return data + size; }
+    size_t Size() const { return size; }
+
+private:
+    const char* data;
+    size_t size;
+    void* map;
+    std::vector<char> buffer;
+};
+
+inline bool IsBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void SkipBlanks(const char*& p, const char* end) {
+    while (p < end && IsBlank(*p)) {
+        ++p;
+    }
+}
+
+// A number ends at a blank, the end of the line or of the file
+inline bool TokenEnd(const char* p, const char* end) {
+    return p == end || IsBlank(*p) || *p == '\n';
+}
+
+inline bool ParseInt(const char*& p, const char* end, long long& value) {
+    SkipBlanks(p, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) ++p;
+    const char* digits = p;
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    value = negative ? -v : v;
+    return p != digits && TokenEnd(p, end);
+}
+
+// Decimal with optional fraction and exponent; the first 19 significant digits are kept, plenty
+// for float positions
+inline bool ParseReal(const char*& p, const char* end, double& value) {
+    static const double Pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    SkipBlanks(p, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) ++p;
+    uint64_t mantissa = 0;
+    int digit_num = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        any = true;
+        if (digit_num < 19) {
+            mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+            digit_num += mantissa > 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+            any = true;
+            if (digit_num < 19) {
+                mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+                digit_num += mantissa > 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        long long e;
+        ++p;
+        if (!ParseInt(p, end, e)) return false;
+        exponent += (int) std::max(-9999LL, std::min(9999LL, e));
+    }
+    double v = (double) mantissa;
+    if (exponent >= -22 && exponent <= 22) {
+        v = exponent < 0 ? v / Pow10[-exponent] : v * Pow10[exponent];
+    } else {
+        v *= std::pow(10.0, (double) exponent);
+    }
+    value = negative ? -v : v;
+    return TokenEnd(p, end);
+}
+
+inline bool ParseVec3(const char*& p, const char* end, glm::vec3& x) {
+    double c[3];
+    for (int a = 0; a < 3; ++a) {
+        if (!ParseReal(p, end, c[a])) return false;
+    }
+    x = glm::vec3((float) c[0], (float) c[1], (float) c[2]);
+    return true;
+}
+
+// Line starts at p: not blank, and not a comment if comments are allowed
+inline bool IsRecord(const char* p, const char* end, bool comments) {
+    SkipBlanks(p, end);
+    return p < end && *p != '\n' && !(comments && *p == '#');
+}
+
+// Offsets of the record lines of file, blank lines (and '#' comments if comments) left out
+// The file is cut in chunks at line starts, each chunk is indexed on its own thread
+std::vector<size_t> IndexRecords(const MappedFile& file, bool comments, ThreadPool& pool) {
+    const char* data = file.Data();
+    const char* end = file.End();
+    size_t size = file.Size();
+    int chunk_num = (int) std::min<size_t>(size / ScanBytes + 1, 64 * (size_t) pool.ThreadNum());
+
+    // Lines starting in [size * c / chunk_num, size * (c + 1) / chunk_num) belong to chunk c
+    std::vector<std::vector<size_t>> chunk_record(chunk_num);
+    pool.ParallelFor(0, chunk_num, 1, [&](int first, int last) {
+        for (int chunk = first; chunk < last; ++chunk) {
+            size_t begin = size * (size_t) chunk / chunk_num;
+            size_t stop = size * (size_t) (chunk + 1) / chunk_num;
+            if (begin > 0) {
+                const void* nl = std::memchr(data + begin - 1, '\n', size - (begin - 1));
+                begin = nl == nullptr ? size : (size_t) (static_cast<const char*>(nl) - data) + 1;
+            }
+            while (begin < stop) {
+                if (IsRecord(data + begin, end, comments)) chunk_record[chunk].push_back(begin);
+                const void* nl = std::memchr(data + begin, '\n', size - begin);
+                begin = nl == nullptr ? size : (size_t) (static_cast<const char*>(nl) - data) + 1;
+            }
+        }
+    });
+    std::vector<size_t> chunk_begin(chunk_num + 1, 0);
+    for (int chunk = 0; chunk < chunk_num; ++chunk) {
+        chunk_begin[chunk + 1] = chunk_begin[chunk] + chunk_record[chunk].size();
+    }
+    std::vector<size_t> record(chunk_begin[chunk_num]);
+    pool.ParallelFor(0, chunk_num, 1, [&](int first, int last) {
+        for (int chunk = first; chunk < last; ++chunk) {
+            std::copy(chunk_record[chunk].begin(), chunk_record[chunk].end(), record.begin() + chunk_begin[chunk]);
+            std::vector<size_t>().swap(chunk_record[chunk]);
+        }
+    });
+    return record;
+}
+
+inline bool Fail(std::string* error, const std::string& message) {
+    if (error != nullptr) *error = message;
+    return false;
+}
+
+// Record starts with word (a Gmsh section tag)
+inline bool RecordIs(const MappedFile& file, size_t offset, const char* word) {
+    const char* p = file.Data() + offset;
+    const char* end = file.End();
+    SkipBlanks(p, end);
+    size_t n = std::strlen(word);
+    return (size_t) (end - p) >= n && std::memcmp(p, word, n) == 0 && TokenEnd(p + n, end);
+}
+
+// Index of the first record at or after from starting with word, record.size() if none
+size_t FindRecord(const MappedFile& file, const std::vector<size_t>& record, size_t from, const char* word) {
+    while (from < record.size() && !RecordIs(file, record[from], word)) {
+        ++from;
+    }
+    return from;
+}
+
+// Integers of record r into value, false if it holds fewer than n
+bool ParseHeader(const MappedFile& file, const std::vector<size_t>& record, size_t r, int n, long long* value) {
+    if (r >= record.size()) return false;
+    const char* p = file.Data() + record[r];
+    for (int i = 0; i < n; ++i) {
+        if (!ParseInt(p, file.End(), value[i])) return false;
+    }
+    return true;
+}
+
+// Node tag -> point index, dense when the tags are, sorted pairs otherwise
+class TagMap {
+public:
+    void Build(const std::vector<long long>& tag) {
+        if (tag.empty()) return;
+        min_tag = *std::min_element(tag.begin(), tag.end());
+        long long max_tag = *std::max_element(tag.begin(), tag.end());
+        dense.clear();
+        sparse.clear();
+        if (max_tag - min_tag < 4 * (long long) tag.size() + 1024) {
+            dense.assign((size_t) (max_tag - min_tag + 1), -1);
+            for (size_t i = 0; i < tag.size(); ++i) {
+                dense[(size_t) (tag[i] - min_tag)] = (int) i;
+            }
+        } else {
+            sparse.resize(tag.size());
+            for (size_t i = 0; i < tag.size(); ++i) {
+                sparse[i] = std::make_pair(tag[i], (int) i);
+            }
+            std::sort(sparse.begin(), sparse.end());
+        }
+    }
+
+    // -1 if tag is not a node
+    int Find(long long tag) const {
+        if (!sparse.empty()) {
+            auto it = std::lower_bound(sparse.begin(), sparse.end(), std::make_pair(tag, -1));
+            return it != sparse.end() && it->first == tag ? it->second : -1;
+        }
+        long long i = tag - min_tag;
+        return i >= 0 && i < (long long) dense.size() ? dense[(size_t) i] : -1;
+    }
+
+private:
+    long long min_tag = 0;
+    std::vector<int> dense;
+    std::vector<std::pair<long long, int>> sparse;
+};
+
+// Index of a degenerate tetrahedra of mesh, -1 if none
+int FindDegenerate(const TetMesh& mesh, ThreadPool& pool) {
+    std::atomic<int> bad(-1);
+    pool.ParallelFor(0, (int) mesh.tetrahedra.size(), RecordGrain, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            const glm::ivec4& th = mesh.tetrahedra[t];
+            glm::dvec3 p4(mesh.points[th[3]]);
+            glm::dvec3 e1 = glm::dvec3(mesh.points[th[0]]) - p4;
+            glm::dvec3 e2 = glm::dvec3(mesh.points[th[1]]) - p4;
+            glm::dvec3 e3 = glm::dvec3(mesh.points[th[2]]) - p4;
+            double edge2 = std::max({glm::dot(e1, e1), glm::dot(e2, e2), glm::dot(e3, e3),
+                                     glm::dot(e1 - e2, e1 - e2), glm::dot(e2 - e3, e2 - e3), glm::dot(e3 - e1, e3 - e1)});
+            if (!(std::fabs(glm::determinant(glm::dmat3(e1, e2, e3))) > DegenerateTetrahedra * edge2 * std::sqrt(edge2))) {
+                bad = t;
+            }
+        }
+    });
+    return bad;
+}
+
+}  // namespace
+
+void BoxLatticeMesh(float unit_length, int W, int L, int H, TetMesh& mesh) {
+    int stride_i = (L + 1) * (H + 1);
+    int stride_j = H + 1;
+    mesh.points.resize((size_t) (W + 1) * stride_i);
+    for (int i = 0; i <= W; ++i) {
+        for (int j = 0; j <= L; ++j) {
+            for (int k = 0; k <= H; ++k) {
+                mesh.points[i * stride_i + j * stride_j + k] =
+                    glm::vec3(unit_length * (float) i, unit_length * (float) j, unit_length * (float) k);
+            }
+        }
+    }
+    mesh.tetrahedra.clear();
+    mesh.tetrahedra.reserve((size_t) W * L * H * TetrahedraPerBox);
+    for (int i = 0; i < W; ++i) {
+        for (int j = 0; j < L; ++j) {
+            for (int k = 0; k < H; ++k) {
+                int m[8];
+                for (int c = 0; c < 8; ++c) {
+                    m[c] = (i + BoxCorner[c][0]) * stride_i + (j + BoxCorner[c][1]) * stride_j + k + BoxCorner[c][2];
+                }
+                for (const int* tet : BoxTetrahedra) {
+                    mesh.tetrahedra.push_back(glm::ivec4(m[tet[0]], m[tet[1]], m[tet[2]], m[tet[3]]));
+                }
+            }
+        }
+    }
+}
+
+bool LoadTetGen(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error) {
+    std::string base = path;
+    for (const char* ext : {".node", ".ele"}) {
+        size_t n = std::strlen(ext);
+        if (base.size() > n && base.compare(base.size() - n, n, ext) == 0) {
+            base.resize(base.size() - n);
+            break;
+        }
+    }
+
+    // .node: <points> <dimension> <attributes> <markers>, then <index> <x> <y> <z> ...
+    MappedFile node_file;
+    if (!node_file.Open(base + ".node")) return Fail(error, "cannot open " + base + ".node");
+    std::vector<size_t> node_record = IndexRecords(node_file, true, pool);
+    long long node_header[2];
+    if (!ParseHeader(node_file, node_record, 0, 2, node_header) || node_header[0] < 0 || node_header[1] != 3 ||
+        (size_t) node_header[0] + 1 > node_record.size()) {
+        return Fail(error, base + ".node: bad header or too few points");
+    }
+    int point_num = (int) node_header[0];
+    long long first_index = 0;
+    if (point_num > 0) {
+        const char* p = node_file.Data() + node_record[1];
+        ParseInt(p, node_file.End(), first_index);
+    }
+    mesh.points.resize(point_num);
+    std::atomic<int> bad(-1);
+    pool.ParallelFor(0, point_num, RecordGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const char* p = node_file.Data() + node_record[i + 1];
+            long long index;
+            if (!ParseInt(p, node_file.End(), index) || index != first_index + i ||
+                !ParseVec3(p, node_file.End(), mesh.points[i])) {
+                bad = i;
+            }
+        }
+    });
+    if (bad >= 0) return Fail(error, base + ".node: bad point " + std::to_string(first_index + bad));
+
+    // .ele: <tetrahedra> <nodes per tetrahedra> <attributes>, then <index> <n1> .. <n4> ...
+    MappedFile ele_file;
+    if (!ele_file.Open(base + ".ele")) return Fail(error, "cannot open " + base + ".ele");
+    std::vector<size_t> ele_record = IndexRecords(ele_file, true, pool);
+    long long ele_header[2];
+    if (!ParseHeader(ele_file, ele_record, 0, 2, ele_header) || ele_header[0] < 0 ||
+        (ele_header[1] != 4 && ele_header[1] != 10) ||
+        (size_t) ele_header[0] + 1 > ele_record.size()) {
+        return Fail(error, base + ".ele: bad header or too few tetrahedra");
+    }
+    int tet_num = (int) ele_header[0];
+    mesh.tetrahedra.resize(tet_num);
+    pool.ParallelFor(0, tet_num, RecordGrain, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            const char* p = ele_file.Data() + ele_record[t + 1];
+            long long value;
+            bool ok = ParseInt(p, ele_file.End(), value);
+            for (int c = 0; c < 4 && ok; ++c) {
+                ok = ParseInt(p, ele_file.End(), value) && value >= first_index && value < first_index + point_num;
+                mesh.tetrahedra[t][c] = (int) (value - first_index);
+            }
+            if (!ok) bad = t;
+        }
+    });
+    if (bad >= 0) return Fail(error, base + ".ele: bad tetrahedra record " + std::to_string(bad + 1));
+    bad = FindDegenerate(mesh, pool);
+    if (bad >= 0) return Fail(error, base + ".ele: degenerate tetrahedra record " + std::to_string(bad + 1));
+    return true;
+}
+
+bool LoadGmsh(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error) {
+    MappedFile file;
+    if (!file.Open(path)) return Fail(error, "cannot open " + path);
+    std::vector<size_t> record = IndexRecords(file, false, pool);
+    const char* end = file.End();
+
+    // $MeshFormat: <version> <file type: 0 ASCII> <data size>
+    size_t r = FindRecord(file, record, 0, "$MeshFormat");
+    if (r + 1 >= record.size()) return Fail(error, path + ": no $MeshFormat");
+    const char* p = file.Data() + record[r + 1];
+    double version;
+    long long file_type;
+    if (!ParseReal(p, end, version) || !ParseInt(p, end, file_type)) {
+        return Fail(error, path + ": bad $MeshFormat");
+    }
+    if (version < 4.0 || version >= 5.0) return Fail(error, path + ": MSH " + std::to_string(version) + ", 4.x expected");
+    if (file_type != 0) return Fail(error, path + ": binary MSH is not supported");
+    // 4.0 puts the tag on each coordinate line and the entity tag first in block headers
+    const bool v41 = version >= 4.05;
+
+    // $Nodes: <blocks> <nodes> [<min tag> <max tag>], per block a header and its nodes
+    r = FindRecord(file, record, r, "$Nodes");
+    long long node_header[2];
+    if (!ParseHeader(file, record, r + 1, 2, node_header) || node_header[0] < 0 || node_header[1] < 0) {
+        return Fail(error, path + ": no $Nodes");
+    }
+    int point_num = (int) node_header[1];
+    mesh.points.resize(point_num);
+    std::vector<long long> tag(point_num);
+    std::atomic<long long> bad(-1);
+    r += 2;
+    int next = 0;
+    for (long long block = 0; block < node_header[0]; ++block) {
+        long long block_header[4];
+        if (!ParseHeader(file, record, r, 4, block_header) || block_header[3] < 0 ||
+            block_header[3] > point_num - next) {
+            return Fail(error, path + ": bad node block " + std::to_string(block));
+        }
+        int n = (int) block_header[3];
+        size_t first = r + 1;
+        if (first + (v41 ? 2 : 1) * (size_t) n > record.size()) return Fail(error, path + ": truncated $Nodes");
+        pool.ParallelFor(0, n, RecordGrain, [&](int begin, int stop) {
+            for (int i = begin; i < stop; ++i) {
+                const char* q = file.Data() + record[first + i];
+                bool ok = ParseInt(q, end, tag[next + i]);
+                if (v41) q = file.Data() + record[first + n + i];
+                if (!ok || !ParseVec3(q, end, mesh.points[next + i])) bad = next + i;
+            }
+        });
+        if (bad >= 0) return Fail(error, path + ": bad node " + std::to_string(bad + 1));
+        next += n;
+        r = first + (v41 ? 2 : 1) * (size_t) n;
+    }
+    if (next != point_num) return Fail(error, path + ": node count mismatch");
+    TagMap tag_map;
+    tag_map.Build(tag);
+
+    // $Elements: <blocks> <elements> [<min tag> <max tag>], per block a header and its elements
+    // Tetrahedra blocks are found first, then parsed in parallel
+    r = FindRecord(file, record, r, "$Elements");
+    long long element_header[2];
+    if (!ParseHeader(file, record, r + 1, 2, element_header) || element_header[0] < 0) {
+        return Fail(error, path + ": no $Elements");
+    }
+    std::vector<std::pair<size_t, int>> tet_block;  // first record, element number
+    r += 2;
+    int tet_num = 0;
+    for (long long block = 0; block < element_header[0]; ++block) {
+        long long block_header[4];
+        if (!ParseHeader(file, record, r, 4, block_header) || block_header[3] < 0 ||
+            r + 1 + (size_t) block_header[3] > record.size()) {
+            return Fail(error, path + ": bad element block " + std::to_string(block));
+        }
+        // 4: 4-node tetrahedra, 11: 10-node tetrahedra
+        if (block_header[2] == 4 || block_header[2] == 11) {
+            tet_block.push_back(std::make_pair(r + 1, (int) block_header[3]));
+            tet_num += (int) block_header[3];
+        }
+        r += 1 + (size_t) block_header[3];
+    }
+    mesh.tetrahedra.resize(tet_num);
+    next = 0;
+    for (const std::pair<size_t, int>& block : tet_block) {
+        pool.ParallelFor(0, block.second, RecordGrain, [&](int begin, int stop) {
+            for (int t = begin; t < stop; ++t) {
+                const char* q = file.Data() + record[block.first + t];
+                long long value;
+                bool ok = ParseInt(q, end, value);
+                for (int c = 0; c < 4 && ok; ++c) {
+                    ok = ParseInt(q, end, value);
+                    mesh.tetrahedra[next + t][c] = tag_map.Find(value);
+                    ok = ok && mesh.tetrahedra[next + t][c] >= 0;
+                }
+                if (!ok) bad = next + t;
+            }
+        });
+        if (bad >= 0) return Fail(error, path + ": bad tetrahedra " + std::to_string(bad + 1));
+        next += block.second;
+    }
+    bad = FindDegenerate(mesh, pool);
+    if (bad >= 0) return Fail(error, path + ": degenerate tetrahedra " + std::to_string(bad + 1));
+    return true;
+}
+
+bool LoadMesh(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".msh") == 0) {
+        return LoadGmsh(path, pool, mesh, error);
+    }
+    return LoadTetGen(path, pool, mesh, error);
+}
+
+}  // namespace model
@@ -0,0 +1,44 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "thread_pool.h"
+
+namespace model {
+
+// Box of the lattice: corners m1..m8 at (i, j, k) + BoxCorner[c], split in 5 tetrahedra
+constexpr int TetrahedraPerBox = 5;
+constexpr int BoxCorner[8][3] = {
+    {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1},
+};
+// Corners of each tetrahedra, positively oriented: det(x1 - x4, x2 - x4, x3 - x4) > 0
+constexpr int BoxTetrahedra[TetrahedraPerBox][4] = {
+    {0, 5, 4, 7}, {0, 1, 5, 2}, {2, 3, 7, 0}, {2, 7, 6, 5}, {0, 2, 5, 7},
+};
+
+// Tetrahedral mesh source of Tofu: rest positions and 0-based corners of every tetrahedra
+struct TetMesh {
+    std::vector<glm::vec3> points;
+    std::vector<glm::ivec4> tetrahedra;
+};
+
+// The box lattice of Tofu(unit_length, W, L, H): points in (i, j, k) order, tetrahedra box by box
+void BoxLatticeMesh(float unit_length, int W, int L, int H, TetMesh& mesh);
+
+// Mesh files, memory-mapped and parsed in parallel on pool
+// False with a message in error (if not null) when a file is missing or malformed, or when a
+// tetrahedra has (almost) no volume
+
+// TetGen path.node and path.ele, path with or without either extension; 0- or 1-based by the
+// first node; 10-node tetrahedra keep their corners
+bool LoadTetGen(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error);
+// Gmsh MSH 4.0 / 4.1 ASCII; 4-node and 10-node tetrahedra (corners), other elements are skipped
+bool LoadGmsh(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error);
+// LoadGmsh for .msh, LoadTetGen otherwise
+bool LoadMesh(const std::string& path, ThreadPool& pool, TetMesh& mesh, std::string* error);
+
+}  // namespace model
+
+#endif  // MESH_H_
@@ -2,7 +2,6 @@
 out vec4 FragColor;
 
 in vec3 FragPos;
-in vec3 Normal;
 
 uniform vec3 lightPos;
 // uniform vec3 viewPos;
@@ -15,7 +14,8 @@ void main() {
     vec3 ambient = ambientStrength * lightColor;
 
 	// Light diffuse
-    vec3 norm = normalize(Normal);
+    // Flat normal of the triangle from the screen-space derivatives, facing the viewer
+    vec3 norm = normalize(cross(dFdx(FragPos), dFdy(FragPos)));
     vec3 lightDir = normalize(lightPos - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
     vec3 diffuse = diff * lightColor;
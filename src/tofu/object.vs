@@ -1,9 +1,7 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
 
 out vec3 FragPos;
-out vec3 Normal;
 
 uniform mat4 model;
 uniform mat4 view;
@@ -11,6 +9,5 @@ uniform mat4 projection;
 
 void main() {
 	FragPos = vec3(model * vec4(aPos, 1.0f));
-    Normal = vec3(model * vec4(aNormal, 0.0));
     gl_Position = projection * view * vec4(FragPos, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "ordering.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace model {
+
+namespace {
+
+// Bits of the interleaved key, x most significant of each triple
+inline uint64_t Interleave(uint32_t x, uint32_t y, uint32_t z, int bits) {
+    uint64_t key = 0;
+    for (int b = bits - 1; b >= 0; --b) {
+        key = key << 3 | (uint64_t) ((x >> b) & 1) << 2 | (uint64_t) ((y >> b) & 1) << 1 | ((z >> b) & 1);
+    }
+    return key;
+}
+
+// Breadth-first levels from start over the points not yet placed; returns the depth of the last
+// level, whose points are left in [level_begin, queue.size())
+int BreadthFirst(const std::vector<int>& row_begin, const std::vector<int>& col, const std::vector<char>& placed,
+                 int start, std::vector<int>& mark, int stamp, std::vector<int>& queue, size_t& level_begin) {
+    queue.clear();
+    queue.push_back(start);
+    mark[start] = stamp;
+    int depth = 0;
+    level_begin = 0;
+    while (true) {
+        size_t level_end = queue.size();
+        for (size_t q = level_begin; q < level_end; ++q) {
+            int u = queue[q];
+            for (int e = row_begin[u]; e < row_begin[u + 1]; ++e) {
+                int v = col[e];
+                if (placed[v] || mark[v] == stamp) continue;
+                mark[v] = stamp;
+                queue.push_back(v);
+            }
+        }
+        if (queue.size() == level_end) return depth;
+        level_begin = level_end;
+        ++depth;
+    }
+}
+
+}  // namespace
+
+const char* PointOrderingName(PointOrdering ordering) {
+    switch (ordering) {
+    case PointOrdering::Morton:
+        return "morton";
+    case PointOrdering::Hilbert:
+        return "hilbert";
+    case PointOrdering::Rcm:
+        return "rcm";
+    default:
+        return "lattice";
+    }
+}
+
+uint64_t MortonKey(uint32_t x, uint32_t y, uint32_t z, int bits) {
+    return Interleave(x, y, z, bits);
+}
+
+// Skilling, "Programming the Hilbert curve" (2004): axes to transposed Hilbert index
+uint64_t HilbertKey(uint32_t x, uint32_t y, uint32_t z, int bits) {
+    uint32_t X[3] = {x, y, z};
+    uint32_t M = 1u << (bits - 1);
+    // Inverse undo
+    for (uint32_t Q = M; Q > 1; Q >>= 1) {
+        uint32_t P = Q - 1;
+        for (int i = 0; i < 3; ++i) {
+            if (X[i] & Q) {
+                X[0] ^= P;
+            } else {
+                uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    // Gray encode
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    uint32_t t = 0;
+    for (uint32_t Q = M; Q > 1; Q >>= 1) {
+        if (X[2] & Q) t ^= Q - 1;
+    }
+    for (int i = 0; i < 3; ++i) {
+        X[i] ^= t;
+    }
+    return Interleave(X[0], X[1], X[2], bits);
+}
+
+std::vector<int> CurveOrder(PointOrdering ordering, int ni, int nj, int nk) {
+    int n = ni * nj * nk;
+    std::vector<int> order(n);
+    for (int p = 0; p < n; ++p) {
+        order[p] = p;
+    }
+    if (ordering != PointOrdering::Morton && ordering != PointOrdering::Hilbert) return order;
+
+    int bits = 1;
+    while ((1 << bits) < std::max(ni, std::max(nj, nk))) {
+        ++bits;
+    }
+    std::vector<std::pair<uint64_t, int>> key(n);
+    for (int i = 0; i < ni; ++i) {
+        for (int j = 0; j < nj; ++j) {
+            for (int k = 0; k < nk; ++k) {
+                int p = (i * nj + j) * nk + k;
+                key[p].first = ordering == PointOrdering::Morton ? MortonKey(i, j, k, bits)
+                                                                 : HilbertKey(i, j, k, bits);
+                key[p].second = p;
+            }
+        }
+    }
+    // Keys are unique, the sort is deterministic
+    std::sort(key.begin(), key.end());
+    for (int p = 0; p < n; ++p) {
+        order[p] = key[p].second;
+    }
+    return order;
+}
+
+std::vector<int> ReverseCuthillMcKee(const std::vector<int>& row_begin, const std::vector<int>& col) {
+    int n = (int) row_begin.size() - 1;
+    std::vector<int> order;
+    order.reserve(n);
+    std::vector<char> placed(n, 0);
+    std::vector<int> mark(n, -1);
+    std::vector<int> queue;
+    std::vector<int> next;
+    auto degree = [&row_begin](int u) { return row_begin[u + 1] - row_begin[u]; };
+
+    int stamp = 0;
+    for (int seed = 0; seed < n; ++seed) {
+        if (placed[seed]) continue;
+        // Pseudo-peripheral start (George & Liu): move to the lowest degree point of the last
+        // level while that makes the component deeper
+        int start = seed;
+        size_t level_begin;
+        int depth = BreadthFirst(row_begin, col, placed, start, mark, stamp++, queue, level_begin);
+        while (true) {
+            int far = queue[level_begin];
+            for (size_t q = level_begin; q < queue.size(); ++q) {
+                if (degree(queue[q]) < degree(far)) far = queue[q];
+            }
+            int far_depth = BreadthFirst(row_begin, col, placed, far, mark, stamp++, queue, level_begin);
+            if (far_depth <= depth) break;
+            start = far;
+            depth = far_depth;
+        }
+
+        // Cuthill-McKee: breadth first, the neighbors of each point by increasing degree
+        size_t component_begin = order.size();
+        order.push_back(start);
+        placed[start] = 1;
+        for (size_t q = component_begin; q < order.size(); ++q) {
+            int u = order[q];
+            next.clear();
+            for (int e = row_begin[u]; e < row_begin[u + 1]; ++e) {
+                int v = col[e];
+                if (placed[v]) continue;
+                placed[v] = 1;
+                next.push_back(v);
+            }
+            std::stable_sort(next.begin(), next.end(), [&degree](int a, int b) { return degree(a) < degree(b); });
+            order.insert(order.end(), next.begin(), next.end());
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+}  // namespace model
@@ -0,0 +1,33 @@
+#ifndef ORDERING_H_
+#define ORDERING_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace model {
+
+// Point numbering of Tofu::Initialize; tetrahedra and surface triangles follow their points
+enum class PointOrdering {
+    Lattice,  // i * (L + 1) * (H + 1) + j * (H + 1) + k, neighbors in i are a plane apart
+    Morton,  // Z-order curve of (i, j, k)
+    Hilbert,  // Hilbert curve of (i, j, k), no jumps between consecutive points
+    Rcm,  // reverse Cuthill-McKee of the tetrahedra graph, smallest bandwidth
+};
+
+const char* PointOrderingName(PointOrdering ordering);
+
+// Curve keys of lattice point (x, y, z), every coordinate < 2^bits, bits <= 21
+uint64_t MortonKey(uint32_t x, uint32_t y, uint32_t z, int bits);
+uint64_t HilbertKey(uint32_t x, uint32_t y, uint32_t z, int bits);
+
+// order[new] = old point of a ni x nj x nk point lattice, old = (i * nj + j) * nk + k, along the
+// Morton / Hilbert curve; Lattice gives the identity
+std::vector<int> CurveOrder(PointOrdering ordering, int ni, int nj, int nk);
+
+// order[new] = old of the graph in CSR (row i: col[row_begin[i] .. row_begin[i + 1])), reverse
+// Cuthill-McKee from a pseudo-peripheral point of each connected component
+std::vector<int> ReverseCuthillMcKee(const std::vector<int>& row_begin, const std::vector<int>& col);
+
+}  // namespace model
+
+#endif  // ORDERING_H_
@@ -0,0 +1,153 @@
+#include "scene.h"
+
+#include <algorithm>
+
+namespace model {
+
+Scene::Scene(ThreadPool* pool) : pool(pool), scheduled(false) {
+    PointNum = 0;
+    SurfaceNum = 0;
+    TetrahedraNum = 0;
+    SurfaceHolderSize = 0;
+    SurfacePositionHolderSize = 0;
+    FailedBodies = 0;
+}
+
+Tofu& Scene::AddBody(float unit_length, int W, int L, int H, const glm::mat3& rotate, const glm::vec3& move) {
+    return AddBody(std::unique_ptr<Tofu>(new Tofu(unit_length, W, L, H)), rotate, move);
+}
+
+Tofu& Scene::AddBody(const TetMesh& mesh, const glm::mat3& rotate, const glm::vec3& move) {
+    return AddBody(std::unique_ptr<Tofu>(new Tofu(mesh, pool)), rotate, move);
+}
+
+Tofu& Scene::AddBody(std::unique_ptr<Tofu> body, const glm::mat3& rotate, const glm::vec3& move) {
+    SceneBody entry;
+    entry.body = std::move(body);
+    entry.body->Pool = pool;
+    entry.rotate = rotate;
+    entry.move = move;
+    entry.surface_offset = SurfaceHolderSize;
+    entry.surface_position_offset = SurfacePositionHolderSize;
+
+    PointNum += entry.body->PointNum;
+    SurfaceNum += entry.body->SurfaceNum;
+    TetrahedraNum += entry.body->TetrahedraNum;
+    SurfaceHolderSize += entry.body->SurfaceHolderSize;
+    SurfacePositionHolderSize += entry.body->SurfacePositionHolderSize;
+    bodies.push_back(std::move(entry));
+    body_substeps.push_back(0);
+    body_status.push_back(StepStatus::Ok);
+    scheduled = false;
+    return *bodies.back().body;
+}
+
+void Scene::Schedule() {
+    large_body.clear();
+    std::vector<int> small_body;
+    long long small_tet_num = 0;
+    for (int i = 0; i < BodyNum(); ++i) {
+        int tet_num = bodies[i].body->TetrahedraNum;
+        if (tet_num >= SceneParallelTetrahedra) {
+            large_body.push_back(i);
+        } else {
+            small_body.push_back(i);
+            small_tet_num += tet_num;
+        }
+    }
+
+    // Enough batches to keep every thread busy, and no batch far above SceneBatchTetrahedra
+    int batch_num = (int) ((small_tet_num + SceneBatchTetrahedra - 1) / SceneBatchTetrahedra);
+    batch_num = std::max(batch_num, pool->ThreadNum());
+    batch_num = std::min(batch_num, (int) small_body.size());
+
+    // Longest processing time first: heaviest body into the lightest batch
+    std::stable_sort(small_body.begin(), small_body.end(), [this](int a, int b) {
+        return bodies[a].body->TetrahedraNum > bodies[b].body->TetrahedraNum;
+    });
+    std::vector<long long> load(batch_num, 0);
+    std::vector<std::vector<int>> batch(batch_num);
+    for (int i : small_body) {
+        int lightest = (int) (std::min_element(load.begin(), load.end()) - load.begin());
+        load[lightest] += bodies[i].body->TetrahedraNum;
+        batch[lightest].push_back(i);
+    }
+
+    // Heaviest batch first, the pool hands out chunks in order
+    std::vector<int> order(batch_num);
+    for (int b = 0; b < batch_num; ++b) {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&load](int a, int b) { return load[a] > load[b]; });
+    batch_begin.assign(1, 0);
+    batch_body.clear();
+    for (int b : order) {
+        batch_body.insert(batch_body.end(), batch[b].begin(), batch[b].end());
+        batch_begin.push_back((int) batch_body.size());
+    }
+    scheduled = true;
+}
+
+void Scene::ForEachBody(const std::function<void(int)>& fn) {
+    if (!scheduled) Schedule();
+    for (int i : large_body) {
+        fn(i);
+    }
+    pool->ParallelFor(0, (int) batch_begin.size() - 1, 1, [&](int begin, int end) {
+        for (int e = batch_begin[begin]; e < batch_begin[end]; ++e) {
+            fn(batch_body[e]);
+        }
+    });
+}
+
+void Scene::Initialize() {
+    ForEachBody([this](int i) {
+        bodies[i].body->Initialize(bodies[i].rotate, bodies[i].move);
+    });
+}
+
+StepStatus Scene::Step(float dt) {
+    ForEachBody([this, dt](int i) {
+        body_status[i] = bodies[i].body->Step(dt);
+    });
+    for (StepStatus status : body_status) {
+        if (status != StepStatus::Ok) return status;
+    }
+    return StepStatus::Ok;
+}
+
+int Scene::Advance(float frame_dt) {
+    ForEachBody([this, frame_dt](int i) {
+        body_substeps[i] = bodies[i].body->Advance(frame_dt);
+    });
+    int substeps = 0;
+    FailedBodies = 0;
+    for (int n : body_substeps) {
+        substeps = std::max(substeps, n);
+        FailedBodies += n == 0;
+    }
+    return substeps;
+}
+
+void Scene::GetSurface(float* holder) {
+    ForEachBody([this, holder](int i) {
+        bodies[i].body->GetSurface(holder + bodies[i].surface_offset);
+    });
+}
+
+void Scene::GetSurfaceIndices(unsigned int* holder) const {
+    // Body i from 3 x its first surface triangle, its indices from its first surface point
+    int index_offset = 0;
+    for (const SceneBody& entry : bodies) {
+        entry.body->GetSurfaceIndices(holder + index_offset, (unsigned int) entry.surface_position_offset / 3);
+        index_offset += 3 * entry.body->SurfaceNum;
+    }
+}
+
+void Scene::GetSurfacePositions(float* holder) {
+    ForEachBody([this, holder](int i) {
+        bodies[i].body->GetSurfacePositions(holder + bodies[i].surface_position_offset);
+    });
+}
+
+}  // namespace model
@@ -0,0 +1,96 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "thread_pool.h"
+#include "tofu.h"
+
+namespace model {
+
+// Bodies with at least this many tetrahedra step alone, their own loops spread over the pool
+const int SceneParallelTetrahedra = 1 << 16;
+// Smaller bodies are packed into tasks of about this many tetrahedra
+const int SceneBatchTetrahedra = 1 << 14;
+
+// Independent soft bodies stepped together on one thread pool
+// Large bodies run one after another with parallel loops inside. The others are packed into
+// batches balanced by tetrahedra count, one task per batch, its bodies stepped serially
+// (nested ParallelFor runs inline), so small bodies cost no per-loop task overhead
+class Scene {
+public:
+    // Totals over the bodies
+    int PointNum;
+    int SurfaceNum;
+    int TetrahedraNum;
+    // Surfaces of every body packed in one holder, body i from SurfaceOffset(i)
+    int SurfaceHolderSize;
+    // Surface point positions of every body packed in one holder, body i from SurfacePositionOffset(i)
+    int SurfacePositionHolderSize;
+    // Advance: bodies that failed the last call (Tofu::Advance returned 0)
+    int FailedBodies;
+
+    explicit Scene(ThreadPool* pool);
+
+    virtual ~Scene() {}
+
+    // New body of W x L x H boxes on the scene pool, placed by Initialize(rotate, move)
+    // Physics settings of the returned body are left to the caller
+    Tofu& AddBody(float unit_length, int W, int L, int H, const glm::mat3& rotate, const glm::vec3& move);
+    // New body of a loaded mesh, see Tofu(const TetMesh&)
+    Tofu& AddBody(const TetMesh& mesh, const glm::mat3& rotate, const glm::vec3& move);
+
+    int BodyNum() const { return (int) bodies.size(); }
+    Tofu& Body(int i) { return *bodies[i].body; }
+    int SurfaceOffset(int i) const { return bodies[i].surface_offset; }
+    int SurfacePositionOffset(int i) const { return bodies[i].surface_position_offset; }
+
+    // Initialize every body at its own rotate / move
+    void Initialize();
+
+    // Simulation, see Tofu::Step / Tofu::Advance
+    // Step returns the status of the first body, in body order, that is not Ok
+    StepStatus Step(float dt);
+    // Each body takes its own substeps; returns the largest substep number of the bodies that
+    // did not fail, failed bodies are counted in FailedBodies
+    int Advance(float frame_dt);
+
+    // Surface plot of every body, Offset = SurfaceHolderSize
+    void GetSurface(float* holder);
+    // Indexed surface plot of every body, see Tofu::GetSurfaceIndices
+    // 3 x SurfaceNum indices into the positions of GetSurfacePositions, Offset = SurfacePositionHolderSize
+    void GetSurfaceIndices(unsigned int* holder) const;
+    void GetSurfacePositions(float* holder);
+
+private:
+    struct SceneBody {
+        std::unique_ptr<Tofu> body;
+        glm::mat3 rotate;
+        glm::vec3 move;
+        int surface_offset;
+        int surface_position_offset;
+    };
+
+    Tofu& AddBody(std::unique_ptr<Tofu> body, const glm::mat3& rotate, const glm::vec3& move);
+    // fn(i) for every body: large bodies in order on the calling thread, then the batches in parallel
+    void ForEachBody(const std::function<void(int)>& fn);
+    // Split bodies into large and batches, after bodies changed
+    void Schedule();
+
+    ThreadPool* pool;
+    std::vector<SceneBody> bodies;
+    std::vector<int> body_substeps;
+    std::vector<StepStatus> body_status;
+
+    bool scheduled;
+    std::vector<int> large_body;
+    // Batch b holds batch_body[batch_begin[b] .. batch_begin[b + 1]), heaviest batch first
+    std::vector<int> batch_begin;
+    std::vector<int> batch_body;
+};
+
+}  // namespace model
+
+#endif  // SCENE_H_
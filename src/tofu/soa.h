@@ -0,0 +1,130 @@
+#ifndef SOA_H_
+#define SOA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <glm/glm.hpp>
+
+namespace model {
+
+// Cache line / AVX-512 register size
+const size_t SoaAlignment = 64;
+
+// Tetrahedra per rest-state block (one AVX-512 or two AVX2 registers)
+const int TetrahedraBlockSize = 16;
+
+// Heap array of POD with 64-byte aligned storage
+template<typename T>
+class AlignedArray {
+public:
+    AlignedArray() : data(nullptr), size(0) {}
+
+    void Allocate(size_t n) {
+        storage = std::unique_ptr<char[]>(new char[n * sizeof(T) + SoaAlignment]);
+        uintptr_t raw = reinterpret_cast<uintptr_t>(storage.get());
+        data = reinterpret_cast<T*>((raw + SoaAlignment - 1) & ~(uintptr_t) (SoaAlignment - 1));
+        size = n;
+    }
+
+    inline T& operator[](size_t i) { return data[i]; }
+    inline const T& operator[](size_t i) const { return data[i]; }
+    inline T* Get() { return data; }
+    inline const T* Get() const { return data; }
+    inline size_t Size() const { return size; }
+
+private:
+    std::unique_ptr<char[]> storage;
+    T* data;
+    size_t size;
+};
+
+// vec3 array as separate x / y / z streams, each 64-byte aligned
+template <class T>
+class BasicVec3Array {
+public:
+    typedef glm::vec<3, T> Vec;
+
+    T* x;
+    T* y;
+    T* z;
+
+    BasicVec3Array() : x(nullptr), y(nullptr), z(nullptr) {}
+
+    void Allocate(int n) {
+        // Pad each stream to whole cache lines so all three stay aligned
+        const size_t line = SoaAlignment / sizeof(T);
+        size_t stride = (n + line - 1) / line * line;
+        storage.Allocate(stride * 3);
+        x = storage.Get();
+        y = x + stride;
+        z = y + stride;
+    }
+
+    inline Vec Get(int i) const {
+        return Vec(x[i], y[i], z[i]);
+    }
+
+    inline void Set(int i, const Vec& v) {
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+
+    inline void Add(int i, const Vec& v) {
+        x[i] += v.x;
+        y[i] += v.y;
+        z[i] += v.z;
+    }
+
+private:
+    AlignedArray<T> storage;
+};
+
+typedef BasicVec3Array<float> Vec3Array;
+typedef BasicVec3Array<double> DVec3Array;
+
+// Rest state of TetrahedraBlockSize tetrahedra, one lane per tetrahedra
+struct alignas(SoaAlignment) TetrahedraRest {
+    float inv_R[9][TetrahedraBlockSize];  // column-major R^-1 (frame at m4)
+    float norm[9][TetrahedraBlockSize];  // norm^* of faces opposite to m4, m3, m2 (x, y, z each)
+
+    inline glm::mat3 GetInvR(int lane) const {
+        return glm::mat3(inv_R[0][lane], inv_R[1][lane], inv_R[2][lane],
+                         inv_R[3][lane], inv_R[4][lane], inv_R[5][lane],
+                         inv_R[6][lane], inv_R[7][lane], inv_R[8][lane]);
+    }
+
+    // f = 0, 1, 2: face opposite to m4, m3, m2
+    inline glm::vec3 GetNorm(int f, int lane) const {
+        return glm::vec3(norm[f * 3][lane], norm[f * 3 + 1][lane], norm[f * 3 + 2][lane]);
+    }
+
+    inline void SetInvR(int lane, const glm::mat3& M) {
+        for (int c = 0; c < 3; ++c) {
+            for (int r = 0; r < 3; ++r) {
+                inv_R[c * 3 + r][lane] = M[c][r];
+            }
+        }
+    }
+
+    inline void SetNorm(int f, int lane, const glm::vec3& n) {
+        norm[f * 3][lane] = n.x;
+        norm[f * 3 + 1][lane] = n.y;
+        norm[f * 3 + 2][lane] = n.z;
+    }
+};
+
+// Corners of TetrahedraBlockSize tetrahedra, one lane per tetrahedra
+// Blocks of the same shape share their TetrahedraRest: lane l of the block has the rest state of
+// lane l of rest[blk.rest]
+// Lanes >= num are padding and must not be scattered
+struct alignas(SoaAlignment) TetrahedraBlock {
+    int m[4][TetrahedraBlockSize];  // m1, m2, m3, m4
+    int num;
+    int rest;
+};
+
+}  // namespace model
+
+#endif  // SOA_H_
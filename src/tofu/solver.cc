@@ -0,0 +1,361 @@
+#include "solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace model {
+
+namespace {
+// Rows per parallel chunk, also the dot product partial sum granularity
+const int RowGrain = 4096;
+}  // namespace
+
+void BuildPointPattern(const TetrahedraBlock* blocks, int block_num, int row_num,
+                       std::vector<int>& row_begin, std::vector<int>& col) {
+    // Every (a, b) corner pair of every tetrahedra, duplicates included
+    std::vector<int> pair_begin(row_num + 1, 0);
+    for (int b = 0; b < block_num; ++b) {
+        const TetrahedraBlock& blk = blocks[b];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            for (int node = 0; node < 4; ++node) {
+                pair_begin[blk.m[node][lane] + 1] += 4;
+            }
+        }
+    }
+    for (int i = 0; i < row_num; ++i) {
+        pair_begin[i + 1] += pair_begin[i];
+    }
+    std::vector<int> pair(pair_begin[row_num]);
+    std::vector<int> pair_end(pair_begin.begin(), pair_begin.end() - 1);
+    for (int b = 0; b < block_num; ++b) {
+        const TetrahedraBlock& blk = blocks[b];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            for (int node = 0; node < 4; ++node) {
+                int& end = pair_end[blk.m[node][lane]];
+                for (int other = 0; other < 4; ++other) {
+                    pair[end++] = blk.m[other][lane];
+                }
+            }
+        }
+    }
+
+    // Sort and merge each row; a point in no tetrahedra keeps its diagonal
+    row_begin.assign(row_num + 1, 0);
+    col.clear();
+    for (int i = 0; i < row_num; ++i) {
+        std::vector<int>::iterator first = pair.begin() + pair_begin[i];
+        std::vector<int>::iterator last = pair.begin() + pair_begin[i + 1];
+        std::sort(first, last);
+        last = std::unique(first, last);
+        if (first == last) {
+            col.push_back(i);
+        }
+        col.insert(col.end(), first, last);
+        row_begin[i + 1] = (int) col.size();
+    }
+}
+
+void BlockCsrMatrix::BuildPattern(const TetrahedraBlock* blocks, int block_num, int row_num) {
+    this->row_num = row_num;
+    BuildPointPattern(blocks, block_num, row_num, row_begin, col);
+    diag.resize(row_num);
+    for (int i = 0; i < row_num; ++i) {
+        diag[i] = Find(i, i);
+    }
+    block.assign(col.size(), glm::mat3(0.0f));
+}
+
+int BlockCsrMatrix::Find(int row, int column) const {
+    const int* first = col.data() + row_begin[row];
+    const int* last = col.data() + row_begin[row + 1];
+    const int* it = std::lower_bound(first, last, column);
+    return (it != last && *it == column) ? (int) (it - col.data()) : -1;
+}
+
+void BlockCsrMatrix::SetZero(ThreadPool& pool) {
+    pool.ParallelFor(0, row_num, RowGrain, [this](int begin, int end) {
+        std::fill(block.begin() + row_begin[begin], block.begin() + row_begin[end], glm::mat3(0.0f));
+    });
+}
+
+void BlockCsrMatrix::Multiply(ThreadPool& pool, const glm::vec3* x, glm::vec3* y) const {
+    pool.ParallelFor(0, row_num, RowGrain, [this, x, y](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            glm::vec3 sum(0.0f);
+            for (int e = row_begin[i]; e < row_begin[i + 1]; ++e) {
+                sum += block[e] * x[col[e]];
+            }
+            y[i] = sum;
+        }
+    });
+}
+
+namespace {
+
+// sum a[i] . b[i], fixed chunk order
+double Dot(ThreadPool& pool, const glm::vec3* a, const glm::vec3* b, int n, std::vector<double>& partial) {
+    pool.ParallelFor(0, n, RowGrain, [&](int begin, int end) {
+        double sum = 0.0;
+        for (int i = begin; i < end; ++i) {
+            sum += (double) glm::dot(a[i], b[i]);
+        }
+        partial[begin / RowGrain] = sum;
+    });
+    double sum = 0.0;
+    for (double s : partial) {
+        sum += s;
+    }
+    return sum;
+}
+
+}  // namespace
+
+CgResult ConjugateGradient(ThreadPool& pool, const LinearOperator& apply, const glm::mat3* inv_diag,
+                           const glm::vec3* b, glm::vec3* x, int n, int max_iterations, float tolerance,
+                           CgWorkspace& ws) {
+    ws.r.resize(n);
+    ws.z.resize(n);
+    ws.p.resize(n);
+    ws.q.resize(n);
+    ws.partial.resize((n + RowGrain - 1) / RowGrain);
+    glm::vec3* r = ws.r.data();
+    glm::vec3* z = ws.z.data();
+    glm::vec3* p = ws.p.data();
+    glm::vec3* q = ws.q.data();
+
+    CgResult result = {0, 0.0f};
+    double b_norm2 = Dot(pool, b, b, n, ws.partial);
+    if (b_norm2 == 0.0) {
+        std::fill(x, x + n, glm::vec3(0.0f));
+        return result;
+    }
+
+    // r = b - A x, z = M^-1 r, p = z
+    apply(x, q);
+    pool.ParallelFor(0, n, RowGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            r[i] = b[i] - q[i];
+            z[i] = inv_diag[i] * r[i];
+            p[i] = z[i];
+        }
+    });
+    double rz = Dot(pool, r, z, n, ws.partial);
+    double r_norm2 = Dot(pool, r, r, n, ws.partial);
+    double stop_norm2 = (double) tolerance * tolerance * b_norm2;
+
+    while (result.iterations < max_iterations && r_norm2 > stop_norm2) {
+        apply(p, q);
+        double pq = Dot(pool, p, q, n, ws.partial);
+        if (!(pq > 0.0)) break;  // A is not positive definite along p
+        float alpha = (float) (rz / pq);
+        pool.ParallelFor(0, n, RowGrain, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * q[i];
+                z[i] = inv_diag[i] * r[i];
+            }
+        });
+        double rz_next = Dot(pool, r, z, n, ws.partial);
+        float beta = (float) (rz_next / rz);
+        rz = rz_next;
+        pool.ParallelFor(0, n, RowGrain, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                p[i] = z[i] + beta * p[i];
+            }
+        });
+        r_norm2 = Dot(pool, r, r, n, ws.partial);
+        ++result.iterations;
+    }
+    result.residual = (float) std::sqrt(r_norm2 / b_norm2);
+    return result;
+}
+
+namespace {
+
+// Rows per nested dissection leaf
+const int DissectionLeafSize = 64;
+
+// Order ids[0, num) into order: both halves of a median cut along the longest axis,
+// then the separator (points of the lower half adjacent to the upper half)
+void Dissect(int* ids, int num, const glm::vec3* coord, const std::vector<int>& row_begin,
+             const std::vector<int>& col, std::vector<char>& side, std::vector<int>& order) {
+    if (num <= DissectionLeafSize) {
+        order.insert(order.end(), ids, ids + num);
+        return;
+    }
+    glm::vec3 lo = coord[ids[0]];
+    glm::vec3 hi = lo;
+    for (int i = 1; i < num; ++i) {
+        lo = glm::min(lo, coord[ids[i]]);
+        hi = glm::max(hi, coord[ids[i]]);
+    }
+    glm::vec3 extent = hi - lo;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    int mid = num / 2;
+    std::nth_element(ids, ids + mid, ids + num, [coord, axis](int a, int b) {
+        return coord[a][axis] < coord[b][axis];
+    });
+
+    // side: 1 lower half, 2 upper half, 3 separator, 0 outside this range
+    for (int i = 0; i < num; ++i) {
+        side[ids[i]] = i < mid ? 1 : 2;
+    }
+    for (int i = 0; i < mid; ++i) {
+        int r = ids[i];
+        for (int e = row_begin[r]; e < row_begin[r + 1]; ++e) {
+            if (side[col[e]] == 2) {
+                side[r] = 3;
+                break;
+            }
+        }
+    }
+    int lower_num = (int) (std::partition(ids, ids + mid, [&side](int r) { return side[r] == 1; }) - ids);
+    for (int i = 0; i < num; ++i) {
+        side[ids[i]] = 0;
+    }
+
+    Dissect(ids, lower_num, coord, row_begin, col, side, order);
+    Dissect(ids + mid, num - mid, coord, row_begin, col, side, order);
+    order.insert(order.end(), ids + lower_num, ids + mid);
+}
+
+}  // namespace
+
+bool SparseCholesky::Factor(int n, const std::vector<int>& row_begin, const std::vector<int>& col,
+                            const std::vector<double>& value, const glm::vec3* coord) {
+    this->n = n;
+
+    // Fill-reducing order
+    std::vector<int> ids(n);
+    for (int i = 0; i < n; ++i) {
+        ids[i] = i;
+    }
+    std::vector<char> side(n, 0);
+    perm.clear();
+    perm.reserve(n);
+    Dissect(ids.data(), n, coord, row_begin, col, side, perm);
+    std::vector<int> inv_perm(n);
+    for (int k = 0; k < n; ++k) {
+        inv_perm[perm[k]] = k;
+    }
+
+    // Upper triangle of P A P^T by columns: column k holds rows i <= k
+    std::vector<int> Ap(n + 1, 0);
+    for (int k = 0; k < n; ++k) {
+        int r = perm[k];
+        for (int e = row_begin[r]; e < row_begin[r + 1]; ++e) {
+            if (inv_perm[col[e]] <= k) ++Ap[k + 1];
+        }
+    }
+    for (int k = 0; k < n; ++k) {
+        Ap[k + 1] += Ap[k];
+    }
+    std::vector<int> Ai(Ap[n]);
+    std::vector<double> Ax(Ap[n]);
+    for (int k = 0; k < n; ++k) {
+        int r = perm[k];
+        int p = Ap[k];
+        for (int e = row_begin[r]; e < row_begin[r + 1]; ++e) {
+            int i = inv_perm[col[e]];
+            if (i <= k) {
+                Ai[p] = i;
+                Ax[p++] = value[e];
+            }
+        }
+    }
+
+    // Symbolic: elimination tree and column counts of L
+    std::vector<int> parent(n);
+    std::vector<int> flag(n);
+    std::vector<int> Lnz(n);
+    for (int k = 0; k < n; ++k) {
+        parent[k] = -1;
+        flag[k] = k;
+        Lnz[k] = 0;
+        for (int p = Ap[k]; p < Ap[k + 1]; ++p) {
+            for (int i = Ai[p]; i < k && flag[i] != k; i = parent[i]) {
+                if (parent[i] == -1) parent[i] = k;
+                ++Lnz[i];
+                flag[i] = k;
+            }
+        }
+    }
+    Lp.assign(n + 1, 0);
+    for (int k = 0; k < n; ++k) {
+        Lp[k + 1] = Lp[k] + Lnz[k];
+    }
+    Li.resize(Lp[n]);
+    Lx.resize(Lp[n]);
+    D.resize(n);
+
+    // Numeric: row k of L from a sparse triangular solve along the elimination tree
+    std::vector<double> Y(n, 0.0);
+    std::vector<int> pattern(n);
+    for (int k = 0; k < n; ++k) {
+        int top = n;
+        flag[k] = k;
+        Lnz[k] = 0;
+        for (int p = Ap[k]; p < Ap[k + 1]; ++p) {
+            int i = Ai[p];
+            Y[i] += Ax[p];
+            int len = 0;
+            for (; flag[i] != k; i = parent[i]) {
+                pattern[len++] = i;
+                flag[i] = k;
+            }
+            while (len > 0) {
+                pattern[--top] = pattern[--len];
+            }
+        }
+        D[k] = Y[k];
+        Y[k] = 0.0;
+        for (; top < n; ++top) {
+            int i = pattern[top];
+            double yi = Y[i];
+            Y[i] = 0.0;
+            int p_end = Lp[i] + Lnz[i];
+            for (int p = Lp[i]; p < p_end; ++p) {
+                Y[Li[p]] -= Lx[p] * yi;
+            }
+            double l_ki = yi / D[i];
+            D[k] -= l_ki * yi;
+            Li[p_end] = k;
+            Lx[p_end] = l_ki;
+            ++Lnz[i];
+        }
+        if (!(D[k] > 0.0)) return false;
+    }
+    work.resize(n);
+    return true;
+}
+
+void SparseCholesky::Solve(const glm::vec3* b, glm::vec3* x) {
+    glm::dvec3* y = work.data();
+    for (int k = 0; k < n; ++k) {
+        y[k] = glm::dvec3(b[perm[k]]);
+    }
+    // L y = b
+    for (int j = 0; j < n; ++j) {
+        glm::dvec3 yj = y[j];
+        for (int p = Lp[j]; p < Lp[j + 1]; ++p) {
+            y[Li[p]] -= Lx[p] * yj;
+        }
+    }
+    // D
+    for (int j = 0; j < n; ++j) {
+        y[j] /= D[j];
+    }
+    // L^T x = y
+    for (int j = n - 1; j >= 0; --j) {
+        glm::dvec3 yj = y[j];
+        for (int p = Lp[j]; p < Lp[j + 1]; ++p) {
+            yj -= Lx[p] * y[Li[p]];
+        }
+        y[j] = yj;
+    }
+    for (int k = 0; k < n; ++k) {
+        x[perm[k]] = glm::vec3(y[k]);
+    }
+}
+
+}  // namespace model
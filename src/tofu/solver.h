@@ -0,0 +1,99 @@
+#ifndef SOLVER_H_
+#define SOLVER_H_
+
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "soa.h"
+#include "thread_pool.h"
+
+namespace model {
+
+// Rows of the symmetric point x point pattern of the tetrahedra of blocks [0, block_num):
+// row i holds the sorted points sharing a tetrahedra with i, i included
+void BuildPointPattern(const TetrahedraBlock* blocks, int block_num, int row_num,
+                       std::vector<int>& row_begin, std::vector<int>& col);
+
+// Sparse matrix of 3x3 blocks in CSR layout, one block row per point
+// The pattern couples every pair of points sharing a tetrahedra and is built once
+class BlockCsrMatrix {
+public:
+    BlockCsrMatrix() : row_num(0) {}
+
+    // Pattern of the tetrahedra of blocks [0, block_num), blocks are zeroed
+    void BuildPattern(const TetrahedraBlock* blocks, int block_num, int row_num);
+
+    int RowNum() const { return row_num; }
+    int BlockNum() const { return (int) col.size(); }
+
+    // Block index of (row, column), -1 if outside the pattern
+    int Find(int row, int column) const;
+    // Block index of (row, row)
+    int Diagonal(int row) const { return diag[row]; }
+
+    glm::mat3& Block(int idx) { return block[idx]; }
+    const glm::mat3& Block(int idx) const { return block[idx]; }
+
+    void SetZero(ThreadPool& pool);
+    // y = A x
+    void Multiply(ThreadPool& pool, const glm::vec3* x, glm::vec3* y) const;
+
+private:
+    int row_num;
+    std::vector<int> row_begin;  // row i owns blocks [row_begin[i], row_begin[i + 1])
+    std::vector<int> col;  // sorted within a row
+    std::vector<int> diag;
+    std::vector<glm::mat3> block;
+};
+
+// y = A x for conjugate gradients
+typedef std::function<void(const glm::vec3* x, glm::vec3* y)> LinearOperator;
+
+// Scratch vectors of ConjugateGradient, resized on use
+struct CgWorkspace {
+    std::vector<glm::vec3> r, z, p, q;
+    std::vector<double> partial;
+};
+
+struct CgResult {
+    int iterations;
+    float residual;  // |b - A x| / |b|
+};
+
+// Solve A x = b by block Jacobi preconditioned conjugate gradients, A symmetric positive definite
+// inv_diag: inverse diagonal blocks of A; x: initial guess in, solution out
+// Dot products sum fixed chunks in order, the result does not depend on the thread number
+CgResult ConjugateGradient(ThreadPool& pool, const LinearOperator& apply, const glm::mat3* inv_diag,
+                           const glm::vec3* b, glm::vec3* x, int n, int max_iterations, float tolerance,
+                           CgWorkspace& ws);
+
+// Sparse LDL^T factorization of a symmetric positive definite scalar matrix
+// Rows are reordered by geometric nested dissection to limit fill; Factor once, Solve many times
+class SparseCholesky {
+public:
+    SparseCholesky() : n(0) {}
+
+    // A in CSR with full rows (both triangles), coord: a position per row for the ordering
+    // Returns false if A is not positive definite
+    bool Factor(int n, const std::vector<int>& row_begin, const std::vector<int>& col,
+                const std::vector<double>& value, const glm::vec3* coord);
+
+    int Size() const { return n; }
+    size_t FactorNonZeroNum() const { return Lx.size(); }
+
+    // x = A^-1 b for each of the 3 components, x may alias b
+    void Solve(const glm::vec3* b, glm::vec3* x);
+
+private:
+    int n;
+    std::vector<int> perm;  // new -> old row
+    std::vector<int> Lp;  // column j of L: rows Li[Lp[j] .. Lp[j + 1]), below the diagonal
+    std::vector<int> Li;
+    std::vector<double> Lx;
+    std::vector<double> D;
+    std::vector<glm::dvec3> work;
+};
+
+}  // namespace model
+
+#endif  // SOLVER_H_
@@ -0,0 +1,100 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace model {
+
+namespace {
+// Set while a thread runs chunks of a loop, nested loops then run inline
+thread_local bool in_parallel_for = false;
+}  // namespace
+
+ThreadPool::ThreadPool(int thread_num) : stop(false), job_id(0), job(nullptr) {
+    for (int i = 1; i < thread_num; ++i) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    job_start.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::Default() {
+    static ThreadPool pool(std::max(1, (int) std::thread::hardware_concurrency()));
+    return pool;
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn) {
+    if (begin >= end) return;
+    grain = std::max(grain, 1);
+    int chunk_num = (end - begin + grain - 1) / grain;
+    if (workers.empty() || chunk_num == 1 || in_parallel_for) {
+        fn(begin, end);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit_lock(submit_mutex);
+    Job cur;
+    cur.fn = &fn;
+    cur.begin = begin;
+    cur.end = end;
+    cur.grain = grain;
+    cur.chunk_num = chunk_num;
+    cur.next_chunk.store(0);
+    cur.done_chunk.store(0);
+    cur.active = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &cur;
+        ++job_id;
+    }
+    job_start.notify_all();
+
+    RunChunks(cur);
+
+    // Workers may still hold cur after the last chunk, wait for them to leave
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [&cur] { return cur.done_chunk.load() == cur.chunk_num && cur.active == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::RunChunks(Job& job) {
+    in_parallel_for = true;
+    int done = 0;
+    for (int c = job.next_chunk++; c < job.chunk_num; c = job.next_chunk++) {
+        int chunk_begin = job.begin + c * job.grain;
+        (*job.fn)(chunk_begin, std::min(chunk_begin + job.grain, job.end));
+        ++done;
+    }
+    job.done_chunk += done;
+    in_parallel_for = false;
+}
+
+void ThreadPool::WorkerLoop() {
+    unsigned long long seen_job = 0;
+    while (true) {
+        Job* cur;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_start.wait(lock, [&] { return stop || (job && job_id != seen_job); });
+            if (stop) return;
+            seen_job = job_id;
+            cur = job;
+            ++cur->active;
+        }
+        RunChunks(*cur);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--cur->active == 0) job_done.notify_all();
+        }
+    }
+}
+
+}  // namespace model
@@ -0,0 +1,58 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace model {
+
+// Fixed set of worker threads running chunked parallel loops
+// The calling thread takes part in the loop; nested ParallelFor calls run inline
+class ThreadPool {
+public:
+    // thread_num counts the caller, so thread_num - 1 workers are spawned
+    explicit ThreadPool(int thread_num);
+    virtual ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int ThreadNum() const { return (int) workers.size() + 1; }
+
+    // fn(chunk_begin, chunk_end) over [begin, end) in chunks of grain, returns when all are done
+    void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn);
+
+    // Shared pool with one thread per hardware thread
+    static ThreadPool& Default();
+
+private:
+    // One ParallelFor call, lives on the caller's stack
+    struct Job {
+        const std::function<void(int, int)>* fn;
+        int begin, end, grain, chunk_num;
+        std::atomic<int> next_chunk;
+        std::atomic<int> done_chunk;
+        int active;  // workers inside RunChunks, guarded by mutex
+    };
+
+    void WorkerLoop();
+    static void RunChunks(Job& job);
+
+    std::vector<std::thread> workers;
+    std::mutex submit_mutex;  // one loop at a time
+
+    std::mutex mutex;
+    std::condition_variable job_start;
+    std::condition_variable job_done;
+    bool stop;
+    unsigned long long job_id;
+    Job* job;
+};
+
+}  // namespace model
+
+#endif  // THREAD_POOL_H_
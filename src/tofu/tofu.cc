@@ -0,0 +1,1685 @@
+#include "tofu.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace model {
+
+namespace {
+
+// target = max(target, value), value not NaN
+inline void AtomicMax(std::atomic<float>& target, float value) {
+    float cur = target.load(std::memory_order_relaxed);
+    while (value > cur && !target.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Tetrahedra per chunk of ExtractSurface, faces per hash partition
+const int FaceGrain = 16384;
+const int FacePartitionSize = 8192;
+
+// Face of a tetrahedra by its sorted corners, face = tetrahedra * 4 + corner opposite to it
+struct FaceEntry {
+    int a, b, c;
+    int face;
+};
+
+inline bool SameFace(const FaceEntry& x, const FaceEntry& y) {
+    return x.a == y.a && x.b == y.b && x.c == y.c;
+}
+
+inline FaceEntry SortedFace(int m1, int m2, int m3, int face) {
+    if (m1 > m2) std::swap(m1, m2);
+    if (m2 > m3) std::swap(m2, m3);
+    if (m1 > m2) std::swap(m1, m2);
+    return FaceEntry{m1, m2, m3, face};
+}
+
+// Multiplicative hash of the corners: its top bits pick the partition, the mixed low bits the
+// slot inside the partition table
+inline uint64_t FaceHash(const FaceEntry& f) {
+    uint64_t h = ((uint64_t) (uint32_t) f.a * 0x9E3779B97F4A7C15ULL + (uint32_t) f.b) * 0xC2B2AE3D27D4EB4FULL + (uint32_t) f.c;
+    return h * 0x165667B19E3779F9ULL;
+}
+
+inline int FacePartition(const FaceEntry& f, int bits) {
+    return bits == 0 ? 0 : (int) (FaceHash(f) >> (64 - bits));
+}
+
+}  // namespace
+
+Tofu::Tofu(float unit_length, int W, int L, int H) {
+    // Geometry
+    dL = unit_length;
+    iNum = W;
+    jNum = L;
+    kNum = H;
+    lattice = true;
+
+    PointNum = (W + 1) * (L + 1) * (H + 1);
+    BoxNum = W * L * H;
+    SurfaceNum = 4 * (W * L + L * H + H * W);
+    TetrahedraNum = TetrahedraPerBox * BoxNum;
+    SurfaceHolderSize = SurfaceNum * 18;
+    TetrahedraHolderSize = TetrahedraNum * 72;
+    // Every point off the (W - 1) x (L - 1) x (H - 1) inner lattice, linked by Initialize
+    SurfacePointNum = PointNum - (W - 1) * (L - 1) * (H - 1);
+    SurfacePositionHolderSize = SurfacePointNum * 3;
+
+    point_ordering = PointOrdering::Lattice;
+    point_index.resize(PointNum);
+    lattice_index.resize(PointNum);
+    surface = std::unique_ptr<SurfaceType[]>(new SurfaceType[SurfaceNum]);
+
+    // Box parity color c = (i % 2) | (j % 2) << 1 | (k % 2) << 2, see Initialize
+    // Inside a color, blocks of slab i (boxes of that i) start a block of their own
+    color_num = LatticeColorNum;
+    slab_block_begin.assign(LatticeColorNum * iNum + 1, 0);
+    for (int c = 0; c < LatticeColorNum; ++c) {
+        int slab_box_num = ParityCount(jNum, (c >> 1) & 1) * ParityCount(kNum, (c >> 2) & 1);
+        for (int i = 0; i < iNum; ++i) {
+            int slab = c * iNum + i;
+            int box_num = i % 2 == (c & 1) ? slab_box_num : 0;
+            slab_block_begin[slab + 1] = slab_block_begin[slab] + (box_num + BoxPerBlock - 1) / BoxPerBlock;
+        }
+    }
+    color_block_begin.assign(LatticeColorNum + 1, 0);
+    for (int c = 0; c <= LatticeColorNum; ++c) {
+        color_block_begin[c] = slab_block_begin[c * iNum];
+    }
+    tetrahedra_block_num = color_block_begin[LatticeColorNum];
+    Setup();
+}
+
+Tofu::Tofu(const TetMesh& mesh, ThreadPool* pool) {
+    // Geometry
+    dL = 0.0f;
+    iNum = jNum = kNum = 0;
+    lattice = false;
+
+    PointNum = (int) mesh.points.size();
+    BoxNum = 0;
+    TetrahedraNum = (int) mesh.tetrahedra.size();
+    TetrahedraHolderSize = TetrahedraNum * 72;
+
+    point_ordering = PointOrdering::Lattice;
+    rest_points = mesh.points;
+    tetrahedra = std::unique_ptr<TetrahedraType[]>(new TetrahedraType[TetrahedraNum]);
+    // Oriented as the lattice tetrahedra, det(x1 - x4, x2 - x4, x3 - x4) > 0
+    for (int t = 0; t < TetrahedraNum; ++t) {
+        const glm::ivec4& m = mesh.tetrahedra[t];
+        TetrahedraType& th = tetrahedra[t];
+        th.m1 = m.x;
+        th.m2 = m.y;
+        th.m3 = m.z;
+        th.m4 = m.w;
+        glm::vec3 p4 = rest_points[th.m4];
+        if (glm::determinant(glm::mat3(rest_points[th.m1] - p4, rest_points[th.m2] - p4, rest_points[th.m3] - p4)) < 0.0f) {
+            std::swap(th.m1, th.m2);
+        }
+    }
+    ColorMesh();
+    Setup();
+    Pool = pool;
+    ExtractSurface();
+    LinkSurfacePoints();
+}
+
+void Tofu::ExtractSurface() {
+    // Faces of a positively oriented tetrahedra, outward: corners in the order whose normal
+    // v12 x v13 points away from the opposite corner
+    // Boundary faces belong to one tetrahedra only; faces are hashed into partitions by their
+    // sorted corners, and each partition finds its unique faces on its own
+    // Partitions of about FacePartitionSize faces sort in cache, and at least 4 per thread
+    int bits = 0;
+    while ((1 << bits) < 4 * Pool->ThreadNum() || ((size_t) 1 << bits) * FacePartitionSize < (size_t) TetrahedraNum * 4) {
+        ++bits;
+    }
+    const int part_num = 1 << bits;
+    const int chunk_num = (TetrahedraNum + FaceGrain - 1) / FaceGrain;
+    auto face_of = [this](int t, int f) {
+        const TetrahedraType& th = tetrahedra[t];
+        switch (f) {
+        case 0: return SurfaceType{th.m2, th.m4, th.m3};
+        case 1: return SurfaceType{th.m1, th.m3, th.m4};
+        case 2: return SurfaceType{th.m1, th.m4, th.m2};
+        default: return SurfaceType{th.m1, th.m2, th.m3};
+        }
+    };
+
+    // Faces per chunk and partition, then each chunk writes its faces in order at its offsets
+    std::vector<int> part_offset((size_t) chunk_num * part_num, 0);
+    Pool->ParallelFor(0, TetrahedraNum, FaceGrain, [&](int begin, int end) {
+        int* count = &part_offset[(size_t) (begin / FaceGrain) * part_num];
+        for (int t = begin; t < end; ++t) {
+            for (int f = 0; f < 4; ++f) {
+                SurfaceType sf = face_of(t, f);
+                ++count[FacePartition(SortedFace(sf.m1, sf.m2, sf.m3, 0), bits)];
+            }
+        }
+    });
+    std::vector<int> part_begin(part_num + 1, 0);
+    for (int p = 0; p < part_num; ++p) {
+        part_begin[p + 1] = part_begin[p];
+        for (int chunk = 0; chunk < chunk_num; ++chunk) {
+            int count = part_offset[(size_t) chunk * part_num + p];
+            part_offset[(size_t) chunk * part_num + p] = part_begin[p + 1];
+            part_begin[p + 1] += count;
+        }
+    }
+    std::vector<FaceEntry> entry((size_t) TetrahedraNum * 4);
+    Pool->ParallelFor(0, TetrahedraNum, FaceGrain, [&](int begin, int end) {
+        int* offset = &part_offset[(size_t) (begin / FaceGrain) * part_num];
+        for (int t = begin; t < end; ++t) {
+            for (int f = 0; f < 4; ++f) {
+                SurfaceType sf = face_of(t, f);
+                FaceEntry e = SortedFace(sf.m1, sf.m2, sf.m3, t * 4 + f);
+                entry[offset[FacePartition(e, bits)]++] = e;
+            }
+        }
+    });
+
+    // Faces seen exactly once, counted in an open addressing table per partition; a face shared
+    // by more than two tetrahedra is not a boundary either
+    std::vector<char> boundary((size_t) TetrahedraNum * 4, 0);
+    Pool->ParallelFor(0, part_num, 1, [&](int begin, int end) {
+        std::vector<int> slot;
+        std::vector<int> seen;
+        for (int p = begin; p < end; ++p) {
+            int size = part_begin[p + 1] - part_begin[p];
+            int mask = 1;
+            while (mask < 2 * size) {
+                mask <<= 1;
+            }
+            --mask;
+            slot.assign(mask + 1, -1);
+            seen.assign(size, 0);
+            const FaceEntry* part = &entry[part_begin[p]];
+            for (int e = 0; e < size; ++e) {
+                uint64_t h = FaceHash(part[e]);
+                int s = (int) ((h ^ h >> 29) & mask);
+                while (slot[s] >= 0 && !SameFace(part[slot[s]], part[e])) {
+                    s = (s + 1) & mask;
+                }
+                if (slot[s] < 0) slot[s] = e;
+                ++seen[slot[s]];
+            }
+            for (int e = 0; e < size; ++e) {
+                if (seen[e] == 1) boundary[part[e].face] = 1;
+            }
+        }
+    });
+    std::vector<FaceEntry>().swap(entry);
+
+    // Boundary faces in tetrahedra order, compacted per chunk
+    std::vector<int> chunk_begin(chunk_num + 1, 0);
+    Pool->ParallelFor(0, TetrahedraNum, FaceGrain, [&](int begin, int end) {
+        int count = 0;
+        for (int e = begin * 4; e < end * 4; ++e) {
+            count += boundary[e];
+        }
+        chunk_begin[begin / FaceGrain + 1] = count;
+    });
+    for (int chunk = 0; chunk < chunk_num; ++chunk) {
+        chunk_begin[chunk + 1] += chunk_begin[chunk];
+    }
+    SurfaceNum = chunk_begin[chunk_num];
+    SurfaceHolderSize = SurfaceNum * 18;
+    surface = std::unique_ptr<SurfaceType[]>(new SurfaceType[SurfaceNum]);
+    Pool->ParallelFor(0, TetrahedraNum, FaceGrain, [&](int begin, int end) {
+        int surface_end = chunk_begin[begin / FaceGrain];
+        for (int e = begin * 4; e < end * 4; ++e) {
+            if (boundary[e]) surface[surface_end++] = face_of(e / 4, e % 4);
+        }
+    });
+}
+
+void Tofu::ColorMesh() {
+    // Greedy: each tetrahedra takes the first color none of its points has yet; colors come in
+    // rounds of 64, so the colors of a point in a round fit in one mask
+    std::vector<int> color(TetrahedraNum, -1);
+    std::vector<uint64_t> used(PointNum);
+    color_num = 0;
+    for (int round = 0, left = TetrahedraNum; left > 0; ++round) {
+        std::fill(used.begin(), used.end(), 0);
+        for (int t = 0; t < TetrahedraNum; ++t) {
+            if (color[t] >= 0) continue;
+            const TetrahedraType& th = tetrahedra[t];
+            uint64_t mask = used[th.m1] | used[th.m2] | used[th.m3] | used[th.m4];
+            if (mask == ~0ULL) continue;
+            int c = 0;
+            while (mask >> c & 1) {
+                ++c;
+            }
+            used[th.m1] |= 1ULL << c;
+            used[th.m2] |= 1ULL << c;
+            used[th.m3] |= 1ULL << c;
+            used[th.m4] |= 1ULL << c;
+            color[t] = round * 64 + c;
+            color_num = std::max(color_num, color[t] + 1);
+            --left;
+        }
+    }
+
+    // Tetrahedra by color, in index order inside a color, TetrahedraBlockSize per block
+    color_tetrahedra_begin.assign(color_num + 1, 0);
+    for (int t = 0; t < TetrahedraNum; ++t) {
+        ++color_tetrahedra_begin[color[t] + 1];
+    }
+    color_block_begin.assign(color_num + 1, 0);
+    for (int c = 0; c < color_num; ++c) {
+        int tet_num = color_tetrahedra_begin[c + 1];
+        color_tetrahedra_begin[c + 1] += color_tetrahedra_begin[c];
+        color_block_begin[c + 1] = color_block_begin[c] + (tet_num + TetrahedraBlockSize - 1) / TetrahedraBlockSize;
+    }
+    color_tetrahedra.resize(TetrahedraNum);
+    std::vector<int> color_end(color_tetrahedra_begin.begin(), color_tetrahedra_begin.end() - 1);
+    for (int t = 0; t < TetrahedraNum; ++t) {
+        color_tetrahedra[color_end[color[t]]++] = t;
+    }
+    tetrahedra_block_num = color_block_begin[color_num];
+}
+
+void Tofu::Setup() {
+    points.Allocate(PointNum);
+
+    // Physics
+    PointMass = 0.01f;
+    StressMu = 1.0f;
+    StressLambda = 1.0f;
+    Material = MaterialModel::StVK;
+    StartVelocity = glm::vec3(0.0f, 0.0f, 0.0f);
+    ConstantAcceleration = glm::vec3(0.0f, -9.8f, 0.0f);
+    Isa = DetectSimdIsa();
+    Pool = &ThreadPool::Default();
+    Assembly = AssemblyMode::Scatter;
+    TemporalSteps = 4;
+    CompactRest = lattice;
+    ImplicitTopology = lattice;
+    implicit_topology = false;
+    Ordering = PointOrdering::Lattice;
+    Integrator = IntegratorMode::Explicit;
+    Precision = PrecisionMode::Float;
+    SolverMaxIterations = 100;
+    SolverTolerance = 1e-3f;
+    SolverIterations = 0;
+    ProjectiveIterations = 10;
+    CourantNumber = 0.1f;
+    MaxSubsteps = 64;
+    Substeps = 0;
+    Rollbacks = 0;
+    SpeedLimit = std::numeric_limits<float>::infinity();
+    StrainLimit = 10.0f;
+    Health = {StepStatus::Ok, 0.0f, 0.0f};
+    CollectStats = false;
+    Stats = StepStats();
+    Time = 0.0;
+    step_scale = 1.0f;
+    step_strain = 0.0f;
+    checkpoint_newest = 0;
+    checkpoint_num = 0;
+    steps_since_checkpoint = 0;
+    min_altitude = 0.0f;
+    rest_volume = 0.0f;
+    projective_key = glm::vec4(0.0f);
+
+    velocity.Allocate(PointNum);
+    acceleration.Allocate(PointNum);
+    acceleration_clear = false;
+    state_precision = PrecisionMode::Float;
+
+    // Point chunks: PointGrain points, or one point plane i of the fused step
+    chunk_health.resize(std::max((PointNum + PointGrain - 1) / PointGrain, iNum + 1));
+    chunk_stats.resize(chunk_health.size());
+    point_chunk_num = 0;
+    chunk_energy.resize(tetrahedra_block_num);
+
+    tet_force.Allocate((size_t) tetrahedra_block_num * TetrahedraForceSize);
+    point_adj_begin.assign(PointNum + 1, 0);
+    point_adj.resize(TetrahedraNum * 4);
+}
+
+void Tofu::LinkSurfacePoints() {
+    // Surface index of each point, -1 off the surface; numbered in point order, so the gather of
+    // GetSurfacePositions reads points front to back
+    std::vector<int> index(PointNum, -1);
+    for (int t = 0; t < SurfaceNum; ++t) {
+        index[surface[t].m1] = index[surface[t].m2] = index[surface[t].m3] = 0;
+    }
+    surface_point.clear();
+    for (int p = 0; p < PointNum; ++p) {
+        if (index[p] < 0) continue;
+        index[p] = (int) surface_point.size();
+        surface_point.push_back(p);
+    }
+    surface_index.resize(SurfaceNum * 3);
+    for (int t = 0; t < SurfaceNum; ++t) {
+        surface_index[t * 3] = index[surface[t].m1];
+        surface_index[t * 3 + 1] = index[surface[t].m2];
+        surface_index[t * 3 + 2] = index[surface[t].m3];
+    }
+    SurfacePointNum = (int) surface_point.size();
+    SurfacePositionHolderSize = SurfacePointNum * 3;
+}
+
+void Tofu::BuildPointOrder() {
+    point_ordering = Ordering;
+    std::vector<int> order;
+    if (Ordering == PointOrdering::Rcm) {
+        // Graph of the points sharing a box, a superset of the tetrahedra edges
+        int stride_i = (jNum + 1) * (kNum + 1);
+        int stride_j = kNum + 1;
+        std::vector<int> pair_begin(PointNum + 1, 0);
+        for (int i = 0; i < iNum; ++i) {
+            for (int j = 0; j < jNum; ++j) {
+                for (int k = 0; k < kNum; ++k) {
+                    int start = i * stride_i + j * stride_j + k;
+                    for (int c = 0; c < 8; ++c) {
+                        pair_begin[start + (c & 1) * stride_i + (c >> 1 & 1) * stride_j + (c >> 2) + 1] += 8;
+                    }
+                }
+            }
+        }
+        for (int p = 0; p < PointNum; ++p) {
+            pair_begin[p + 1] += pair_begin[p];
+        }
+        std::vector<int> pair(pair_begin[PointNum]);
+        std::vector<int> pair_end(pair_begin.begin(), pair_begin.end() - 1);
+        for (int i = 0; i < iNum; ++i) {
+            for (int j = 0; j < jNum; ++j) {
+                for (int k = 0; k < kNum; ++k) {
+                    int start = i * stride_i + j * stride_j + k;
+                    int m[8];
+                    for (int c = 0; c < 8; ++c) {
+                        m[c] = start + (c & 1) * stride_i + (c >> 1 & 1) * stride_j + (c >> 2);
+                    }
+                    for (int c = 0; c < 8; ++c) {
+                        std::copy(m, m + 8, pair.begin() + pair_end[m[c]]);
+                        pair_end[m[c]] += 8;
+                    }
+                }
+            }
+        }
+        std::vector<int> row_begin(PointNum + 1, 0);
+        std::vector<int> col;
+        for (int p = 0; p < PointNum; ++p) {
+            std::vector<int>::iterator first = pair.begin() + pair_begin[p];
+            std::vector<int>::iterator last = pair.begin() + pair_begin[p + 1];
+            std::sort(first, last);
+            col.insert(col.end(), first, std::unique(first, last));
+            row_begin[p + 1] = (int) col.size();
+        }
+        order = ReverseCuthillMcKee(row_begin, col);
+    } else {
+        order = CurveOrder(Ordering, iNum + 1, jNum + 1, kNum + 1);
+    }
+    for (int p = 0; p < PointNum; ++p) {
+        lattice_index[p] = order[p];
+        point_index[order[p]] = p;
+    }
+}
+
+void Tofu::LinkLattice() {
+    int stride_i = (jNum + 1) * (kNum + 1);
+    int stride_j = kNum + 1;
+    if (Ordering != point_ordering) {
+        // Renumbered points: the implicit pattern and the projective factor are built again
+        system = BlockCsrMatrix();
+        projective_key = glm::vec4(0.0f);
+    }
+    BuildPointOrder();
+    // Implicit topology needs the (i, j, k) box order of Lattice inside each slab
+    implicit_topology = ImplicitTopology && point_ordering == PointOrdering::Lattice;
+    if (implicit_topology) {
+        tetrahedra.reset();
+        tet_blocks = AlignedArray<TetrahedraBlock>();
+    } else {
+        if (!tetrahedra) tetrahedra = std::unique_ptr<TetrahedraType[]>(new TetrahedraType[TetrahedraNum]);
+        if (tet_blocks.Size() != (size_t) tetrahedra_block_num) tet_blocks.Allocate(tetrahedra_block_num);
+    }
+    for (int p = 0; p < TetrahedraPerBox; ++p) {
+        for (int node = 0; node < 4; ++node) {
+            const int* corner = BoxCorner[BoxTetrahedra[p][node]];
+            box_tetrahedra_offset[p][node] = corner[0] * stride_i + corner[1] * stride_j + corner[2];
+        }
+    }
+    for (int node = 0; node < 4; ++node) {
+        for (int lane = 0; lane < TetrahedraBlockSize; ++lane) {
+            int n = lane / TetrahedraPerBox;
+            block_lane_offset[node][lane] =
+                n < BoxPerBlock ? 2 * n + box_tetrahedra_offset[lane % TetrahedraPerBox][node] : 0;
+        }
+    }
+    // Initialize Position
+    for (int i = 0; i < iNum + 1; ++i) {
+        for (int j = 0; j < jNum + 1; ++j) {
+            for (int k = 0; k < kNum + 1; ++k) {
+                points.Set(point_index[i * stride_i + j * stride_j + k],
+                    glm::vec3(dL * (float) i, dL * (float) j, dL * (float) k));
+            }
+        }
+    }
+
+    // Boxes in the order of their first point m1, the (i, j, k) order under Lattice
+    // Box box_order[n] links tetrahedra [5 n, 5 n + 5)
+    std::vector<std::pair<int, int>> box_key(BoxNum);
+    for (int box = 0; box < BoxNum; ++box) {
+        int i = box / (jNum * kNum), j = box / kNum % jNum, k = box % kNum;
+        box_key[box] = std::make_pair(point_index[i * stride_i + j * stride_j + k], box);
+    }
+    std::sort(box_key.begin(), box_key.end());
+
+    // Link topology
+    int surface_end = 0;
+    int tetrahedra_end = 0;
+    for (int n = 0; n < BoxNum; ++n) {
+        int box = box_key[n].second;
+        int i = box / (jNum * kNum), j = box / kNum % jNum, k = box % kNum;
+        int m1, m2, m3, m4, m5, m6, m7, m8;
+        int start = i * stride_i + j * stride_j + k;
+        // Link Box
+        m1 = point_index[start];
+        m2 = point_index[start + stride_i];
+        m3 = point_index[start + stride_i + stride_j];
+        m4 = point_index[start + stride_j];
+        m5 = point_index[start + 1];
+        m6 = point_index[start + 1 + stride_i];
+        m7 = point_index[start + 1 + stride_i + stride_j];
+        m8 = point_index[start + 1 + stride_j];
+
+        // Link Surface (x6)
+        LinkSurfaceIf(i, 0, m1, m5, m8, m4, surface_end);  // Front
+        LinkSurfaceIf(i, iNum - 1, m2, m3, m7, m6, surface_end);  // Back
+        LinkSurfaceIf(k, 0, m1, m4, m3, m2, surface_end);  // Left
+        LinkSurfaceIf(k, kNum - 1, m5, m6, m7, m8, surface_end);  // Right
+        LinkSurfaceIf(j, 0, m1, m2, m6, m5, surface_end);  // Down
+        LinkSurfaceIf(j, jNum - 1, m3, m4, m8, m7, surface_end);  // Up
+
+        // Link Tetrahedra (x5)
+        if (implicit_topology) continue;
+        const int m[8] = {m1, m2, m3, m4, m5, m6, m7, m8};
+        for (int p = 0; p < TetrahedraPerBox; ++p) {
+            const int* corner = BoxTetrahedra[p];
+            LinkTetrahedra(m[corner[0]], m[corner[1]], m[corner[2]], m[corner[3]], tetrahedra_end);
+        }
+    }
+    // std::cout << "Link Surface Number: " << surface_end << std::endl;
+    // std::cout << "Link Tetrahedra Number: " << tetrahedra_end << std::endl;
+
+    // Pre-compute physical params
+    // Boxes of one parity color share no points, and a block only holds whole
+    // boxes of one color, so the blocks of a color can be solved concurrently
+    // Slab c * iNum + i of box n, boxes keep the box order inside a slab
+    // Lattice keeps the slabs of the fused step; the other orderings put every box of color c in
+    // its first slab, so that its blocks follow the point order instead of sweeping it per slab
+    std::vector<int> box_slab(BoxNum);
+    std::vector<int> slab_box_begin(LatticeColorNum * iNum + 1, 0);
+    for (int n = 0; n < BoxNum; ++n) {
+        int box = box_key[n].second;
+        int i = box / (jNum * kNum), j = box / kNum % jNum, k = box % kNum;
+        int c = (i & 1) | (j & 1) << 1 | (k & 1) << 2;
+        box_slab[n] = c * iNum + (point_ordering == PointOrdering::Lattice ? i : c & 1);
+        ++slab_box_begin[box_slab[n] + 1];
+    }
+    // At most the blocks of the lattice layout the constructor allocated
+    for (int slab = 0; slab < LatticeColorNum * iNum; ++slab) {
+        int box_num = slab_box_begin[slab + 1];
+        slab_box_begin[slab + 1] += slab_box_begin[slab];
+        slab_block_begin[slab + 1] = slab_block_begin[slab] + (box_num + BoxPerBlock - 1) / BoxPerBlock;
+    }
+    for (int c = 0; c <= LatticeColorNum; ++c) {
+        color_block_begin[c] = slab_block_begin[c * iNum];
+    }
+    tetrahedra_block_num = color_block_begin[LatticeColorNum];
+    std::vector<int> slab_box(BoxNum);
+    std::vector<int> slab_box_end(slab_box_begin.begin(), slab_box_begin.end() - 1);
+    for (int n = 0; n < BoxNum; ++n) {
+        slab_box[slab_box_end[box_slab[n]]++] = n;
+    }
+
+    // Lane l of a block holds tetrahedra l % 5 of box l / 5, so blocks of the same number of boxes
+    // share their rest state: rest k - 1 for k boxes, from the box at the origin
+    int rest_num = CompactRest ? BoxPerBlock : tetrahedra_block_num;
+    if (tet_rest.Size() != (size_t) rest_num) tet_rest.Allocate(rest_num);
+    if (CompactRest) {
+        int origin = 0;
+        while (box_key[origin].second != 0) {
+            ++origin;
+        }
+        for (int k = 1; k <= BoxPerBlock; ++k) {
+            for (int lane = 0; lane < k * TetrahedraPerBox; ++lane) {
+                LinkRestLane(tet_rest[k - 1], lane, TetrahedraOf(origin * TetrahedraPerBox + lane % TetrahedraPerBox));
+            }
+            PadRest(tet_rest[k - 1], k * TetrahedraPerBox);
+        }
+    }
+    if (implicit_topology) {
+        if (CompactRest) return;
+        TetrahedraBlock blk;
+        for (int b = 0; b < tetrahedra_block_num; ++b) {
+            LatticeBlocks(b, b + 1, &blk);
+            for (int lane = 0; lane < blk.num; ++lane) {
+                LinkRestLane(tet_rest[b], lane, {blk.m[0][lane], blk.m[1][lane], blk.m[2][lane], blk.m[3][lane]});
+            }
+            PadRest(tet_rest[b], blk.num);
+        }
+        return;
+    }
+    auto close_block = [this](int b, int num) {
+        PadBlock(tet_blocks[b], num);
+        if (CompactRest) {
+            tet_blocks[b].rest = num / TetrahedraPerBox - 1;
+        } else {
+            tet_blocks[b].rest = b;
+            PadRest(tet_rest[b], num);
+        }
+    };
+    for (int slab = 0; slab < LatticeColorNum * iNum; ++slab) {
+        int b = slab_block_begin[slab];
+        int lane = 0;
+        for (int s = slab_box_begin[slab]; s < slab_box_begin[slab + 1]; ++s) {
+            if (lane + TetrahedraPerBox > TetrahedraBlockSize) {
+                close_block(b++, lane);
+                lane = 0;
+            }
+            for (int t = 0; t < TetrahedraPerBox; ++t) {
+                int tet = slab_box[s] * TetrahedraPerBox + t;
+                LinkBlockLane(tet_blocks[b], lane, tet);
+                if (!CompactRest) LinkRestLane(tet_rest[b], lane, tetrahedra[tet]);
+                ++lane;
+            }
+        }
+        if (lane > 0) {
+            close_block(b, lane);
+        }
+    }
+}
+
+void Tofu::LatticeBlocks(int begin, int end, TetrahedraBlock* blk) const {
+    const int stride_i = (jNum + 1) * (kNum + 1);
+    const int stride_j = kNum + 1;
+    int slab = (int) (std::upper_bound(slab_block_begin.begin(), slab_block_begin.end(), begin) -
+                      slab_block_begin.begin()) - 1;
+    // Box s of the slab is its box (2 j + cj, 2 k + ck), s = j nk + k
+    int s = (begin - slab_block_begin[slab]) * BoxPerBlock;
+    int c = slab / iNum, i = slab % iNum;
+    int cj = (c >> 1) & 1, ck = (c >> 2) & 1;
+    int nk = ParityCount(kNum, ck);
+    int box_num = ParityCount(jNum, cj) * nk;
+    int j = s / nk, k = s % nk;
+    for (int b = begin; b < end; ++b, ++blk) {
+        if (b == slab_block_begin[slab + 1]) {
+            while (b == slab_block_begin[slab + 1]) {
+                ++slab;
+            }
+            c = slab / iNum;
+            i = slab % iNum;
+            cj = (c >> 1) & 1;
+            ck = (c >> 2) & 1;
+            nk = ParityCount(kNum, ck);
+            box_num = ParityCount(jNum, cj) * nk;
+            s = j = k = 0;
+        }
+        int num = std::min(BoxPerBlock, box_num - s);
+        if (k + num <= nk) {
+            // One row of boxes, the common case: 16 lanes at once
+            int start = i * stride_i + (2 * j + cj) * stride_j + 2 * k + ck;
+            for (int node = 0; node < 4; ++node) {
+                for (int lane = 0; lane < TetrahedraBlockSize; ++lane) {
+                    blk->m[node][lane] = start + block_lane_offset[node][lane];
+                }
+            }
+        } else {
+            for (int n = 0; n < num; ++n) {
+                int start = i * stride_i + (2 * ((s + n) / nk) + cj) * stride_j + 2 * ((s + n) % nk) + ck;
+                for (int p = 0; p < TetrahedraPerBox; ++p) {
+                    for (int node = 0; node < 4; ++node) {
+                        blk->m[node][n * TetrahedraPerBox + p] = start + box_tetrahedra_offset[p][node];
+                    }
+                }
+            }
+        }
+        PadBlock(*blk, num * TetrahedraPerBox);
+        blk->rest = CompactRest ? num - 1 : b;
+        s += num;
+        k += num;
+        while (k >= nk) {
+            k -= nk;
+            ++j;
+        }
+    }
+}
+
+void Tofu::StoreBlocks() {
+    if (!implicit_topology) return;
+    tet_blocks.Allocate(tetrahedra_block_num);
+    LatticeBlocks(0, tetrahedra_block_num, tet_blocks.Get());
+    implicit_topology = false;
+}
+
+void Tofu::LinkMesh() {
+    if (tet_blocks.Size() != (size_t) tetrahedra_block_num) tet_blocks.Allocate(tetrahedra_block_num);
+    for (int p = 0; p < PointNum; ++p) {
+        points.Set(p, rest_points[p]);
+    }
+    // Tetrahedra of a color share no points, so the blocks of a color can be solved concurrently
+    if (tet_rest.Size() != (size_t) tetrahedra_block_num) tet_rest.Allocate(tetrahedra_block_num);
+    for (int c = 0; c < color_num; ++c) {
+        int t = color_tetrahedra_begin[c];
+        for (int b = color_block_begin[c]; b < color_block_begin[c + 1]; ++b) {
+            int num = std::min(TetrahedraBlockSize, color_tetrahedra_begin[c + 1] - t);
+            for (int lane = 0; lane < num; ++lane) {
+                LinkBlockLane(tet_blocks[b], lane, color_tetrahedra[t]);
+                LinkRestLane(tet_rest[b], lane, tetrahedra[color_tetrahedra[t++]]);
+            }
+            PadBlock(tet_blocks[b], num);
+            PadRest(tet_rest[b], num);
+            tet_blocks[b].rest = b;
+        }
+    }
+}
+
+void Tofu::Initialize(glm::mat3 rotate, glm::vec3 move) {
+    if (lattice) {
+        LinkLattice();
+        LinkSurfacePoints();
+    } else {
+        LinkMesh();
+    }
+
+    // Smallest altitude and volume of the rest shape for StableTimeStep
+    // volume = |det R| / 6, altitude = 3 volume / area, |norm^*| = face area
+    min_altitude = std::numeric_limits<float>::max();
+    rest_volume = 0.0f;
+    TetrahedraBlock blk;
+    for (int b = 0; b < tetrahedra_block_num; ++b) {
+        GetBlock(b, blk);
+        const TetrahedraRest& blk_rest = tet_rest[blk.rest];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            float volume = 1.0f / (6.0f * std::fabs(glm::determinant(blk_rest.GetInvR(lane))));
+            glm::vec3 n0 = blk_rest.GetNorm(0, lane);
+            glm::vec3 n1 = blk_rest.GetNorm(1, lane);
+            glm::vec3 n2 = blk_rest.GetNorm(2, lane);
+            float max_area = std::max(std::max(glm::length(n0), glm::length(n1)),
+                                      std::max(glm::length(n2), glm::length(n0 + n1 + n2)));
+            min_altitude = std::min(min_altitude, 3.0f * volume / max_area);
+            rest_volume += volume;
+        }
+    }
+
+    // Point -> force buffer adjacency (CSR) for gather assembly
+    // Entries follow block, lane, node order: the scatter order of SolveBlocks
+    std::fill(point_adj_begin.begin(), point_adj_begin.end(), 0);
+    for (int b = 0; b < tetrahedra_block_num; ++b) {
+        GetBlock(b, blk);
+        for (int lane = 0; lane < blk.num; ++lane) {
+            for (int node = 0; node < 4; ++node) {
+                ++point_adj_begin[blk.m[node][lane] + 1];
+            }
+        }
+    }
+    for (int i = 0; i < PointNum; ++i) {
+        point_adj_begin[i + 1] += point_adj_begin[i];
+    }
+    std::vector<int> point_adj_end(point_adj_begin.begin(), point_adj_begin.end() - 1);
+    for (int b = 0; b < tetrahedra_block_num; ++b) {
+        GetBlock(b, blk);
+        for (int lane = 0; lane < blk.num; ++lane) {
+            for (int node = 0; node < 4; ++node) {
+                point_adj[point_adj_end[blk.m[node][lane]]++] =
+                    b * TetrahedraForceSize + node * 3 * TetrahedraBlockSize + lane;
+            }
+        }
+    }
+
+    // Translate & Set start velocity
+    for (int pi = 0; pi < PointNum; ++pi) {
+        points.Set(pi, rotate * points.Get(pi) + move);
+        velocity.Set(pi, StartVelocity);
+    }
+    Time = 0.0;
+    step_scale = 1.0f;
+    checkpoint_num = 0;
+    // The double arrays are filled from these on the next Mixed / Double step
+    state_precision = PrecisionMode::Float;
+    acceleration_clear = false;
+}
+
+// Simulation
+StepStatus Tofu::Step(float dt, int steps) {
+    if (checkpoint_num == 0 || steps_since_checkpoint >= CheckpointInterval) {
+        SaveCheckpoint();
+    }
+    steps_since_checkpoint += steps;
+    return Integrate(dt * (float) steps, dt, std::numeric_limits<int>::max()) > 0 ? StepStatus::Ok
+                                                                                    : Health.status;
+}
+
+StepStatus Tofu::TryStep(float dt) {
+    switch (Integrator) {
+    case IntegratorMode::Projective:
+        return StepProjective(dt);
+    case IntegratorMode::Implicit:
+    case IntegratorMode::ImplicitMatrixFree:
+        return StepImplicit(dt);
+    default:
+        if (Assembly != AssemblyMode::Scatter && Assembly != AssemblyMode::Gather && lattice &&
+            point_ordering == PointOrdering::Lattice) {
+            return StepFused(dt);
+        }
+        ClearAcceleration();
+        SolveElements();
+        return IntegrateExplicit(dt);
+    }
+}
+
+float Tofu::StableTimeStep() const {
+    float modulus = 3.0f * (StressLambda + 2.0f * StressMu);
+    if (!(modulus > 0.0f)) return std::numeric_limits<float>::max();
+    float density = PointMass * (float) PointNum / rest_volume;
+    return CourantNumber * min_altitude * std::sqrt(density / modulus);
+}
+
+int Tofu::Advance(float frame_dt) {
+    if (!(frame_dt > 0.0f)) return 0;
+    SaveCheckpoint();
+    // Implicit modes take the frame in one step unless a rollback asks for less
+    float max_dt = Integrator == IntegratorMode::Explicit ? StableTimeStep() : frame_dt;
+    return Integrate(frame_dt, max_dt, MaxSubsteps);
+}
+
+int Tofu::Integrate(float span, float max_dt, int max_substeps) {
+    double target = Time + span;
+    Rollbacks = 0;
+    while (true) {
+        float sub_dt = max_dt * step_scale;
+        int substeps = std::max(1, (int) std::ceil(std::min(span / sub_dt - 1e-4f, 1e9f)));
+        // Past max_substeps the rest of the span is dropped
+        if (substeps > max_substeps) {
+            substeps = max_substeps;
+        } else if ((float) substeps * sub_dt != span) {
+            // Step(dt, steps) keeps dt as is
+            sub_dt = span / (float) substeps;
+        }
+
+        StepStatus status = StepStatus::Ok;
+        const int batch = TemporalBatch();
+        for (int s = 0; s < substeps && status == StepStatus::Ok;) {
+            int steps = std::min(batch, substeps - s);
+            status = steps > 1 ? StepTemporal(sub_dt, steps) : TryStep(sub_dt);
+            s += steps;
+        }
+        if (status == StepStatus::Ok) {
+            Time = substeps * sub_dt < span ? Time + substeps * sub_dt : target;
+            Substeps = substeps;
+            // Creep back toward the full step
+            step_scale = std::min(1.0f, step_scale * AdvanceRecovery);
+            return substeps;
+        }
+
+        // Redo from the newest checkpoint, which may be older than the start of the span
+        // Past half the rollbacks the checkpoint itself may be past saving, fall back one more
+        if (Rollbacks == AdvanceMaxRollbacks / 2 && checkpoint_num > 1) {
+            checkpoint_newest = (checkpoint_newest + CheckpointRingSize - 1) % CheckpointRingSize;
+            --checkpoint_num;
+        }
+        RestoreCheckpoint();
+        span = (float) (target - Time);
+        if (Rollbacks == AdvanceMaxRollbacks) {
+            // Smaller steps did not help, start over at full scale; Health keeps the failed status
+            step_scale = 1.0f;
+            Substeps = 0;
+            return 0;
+        }
+        ++Rollbacks;
+        step_scale *= 0.5f;
+    }
+}
+
+void Tofu::SaveCheckpoint() {
+    checkpoint_newest = (checkpoint_newest + 1) % CheckpointRingSize;
+    checkpoint_num = std::min(checkpoint_num + 1, CheckpointRingSize);
+    steps_since_checkpoint = 0;
+    Checkpoint& cp = checkpoint[checkpoint_newest];
+    cp.time = Time;
+    cp.precision = state_precision;
+    if (state_precision != PrecisionMode::Float) {
+        // points only mirrors points_d
+        if (cp.points_d.x == nullptr) {
+            cp.points_d.Allocate(PointNum);
+            cp.velocity_d.Allocate(PointNum);
+        }
+        Pool->ParallelFor(0, PointNum, PointGrain, [this, &cp](int begin, int end) {
+            std::copy(points_d.x + begin, points_d.x + end, cp.points_d.x + begin);
+            std::copy(points_d.y + begin, points_d.y + end, cp.points_d.y + begin);
+            std::copy(points_d.z + begin, points_d.z + end, cp.points_d.z + begin);
+            std::copy(velocity_d.x + begin, velocity_d.x + end, cp.velocity_d.x + begin);
+            std::copy(velocity_d.y + begin, velocity_d.y + end, cp.velocity_d.y + begin);
+            std::copy(velocity_d.z + begin, velocity_d.z + end, cp.velocity_d.z + begin);
+        });
+        return;
+    }
+    if (cp.points.x == nullptr) {
+        cp.points.Allocate(PointNum);
+        cp.velocity.Allocate(PointNum);
+    }
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, &cp](int begin, int end) {
+        std::copy(points.x + begin, points.x + end, cp.points.x + begin);
+        std::copy(points.y + begin, points.y + end, cp.points.y + begin);
+        std::copy(points.z + begin, points.z + end, cp.points.z + begin);
+        std::copy(velocity.x + begin, velocity.x + end, cp.velocity.x + begin);
+        std::copy(velocity.y + begin, velocity.y + end, cp.velocity.y + begin);
+        std::copy(velocity.z + begin, velocity.z + end, cp.velocity.z + begin);
+    });
+}
+
+void Tofu::RestoreCheckpoint() {
+    const Checkpoint& cp = checkpoint[checkpoint_newest];
+    Time = cp.time;
+    if (cp.precision != state_precision) {
+        state_precision = cp.precision;
+        acceleration_clear = false;
+    }
+    if (cp.precision != PrecisionMode::Float) {
+        Pool->ParallelFor(0, PointNum, PointGrain, [this, &cp](int begin, int end) {
+            std::copy(cp.points_d.x + begin, cp.points_d.x + end, points_d.x + begin);
+            std::copy(cp.points_d.y + begin, cp.points_d.y + end, points_d.y + begin);
+            std::copy(cp.points_d.z + begin, cp.points_d.z + end, points_d.z + begin);
+            std::copy(cp.velocity_d.x + begin, cp.velocity_d.x + end, velocity_d.x + begin);
+            std::copy(cp.velocity_d.y + begin, cp.velocity_d.y + end, velocity_d.y + begin);
+            std::copy(cp.velocity_d.z + begin, cp.velocity_d.z + end, velocity_d.z + begin);
+            for (int i = begin; i < end; ++i) {
+                points.Set(i, glm::vec3(points_d.Get(i)));
+            }
+        });
+        return;
+    }
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, &cp](int begin, int end) {
+        std::copy(cp.points.x + begin, cp.points.x + end, points.x + begin);
+        std::copy(cp.points.y + begin, cp.points.y + end, points.y + begin);
+        std::copy(cp.points.z + begin, cp.points.z + end, points.z + begin);
+        std::copy(cp.velocity.x + begin, cp.velocity.x + end, velocity.x + begin);
+        std::copy(cp.velocity.y + begin, cp.velocity.y + end, velocity.y + begin);
+        std::copy(cp.velocity.z + begin, cp.velocity.z + end, velocity.z + begin);
+    });
+}
+
+bool Tofu::Rollback(int age) {
+    if (age < 0 || age >= checkpoint_num) return false;
+    checkpoint_newest = (checkpoint_newest - age + CheckpointRingSize) % CheckpointRingSize;
+    checkpoint_num -= age;
+    RestoreCheckpoint();
+    steps_since_checkpoint = 0;
+    return true;
+}
+
+void Tofu::SyncPrecision() {
+    PrecisionMode precision = Integrator == IntegratorMode::Explicit ? Precision : PrecisionMode::Float;
+    if (precision == state_precision) return;
+    if (precision != PrecisionMode::Float && points_d.x == nullptr) {
+        points_d.Allocate(PointNum);
+        velocity_d.Allocate(PointNum);
+    }
+    if (precision == PrecisionMode::Double && acceleration_d.x == nullptr) {
+        acceleration_d.Allocate(PointNum);
+    }
+    // Mixed <-> Double share the double state; points always mirrors points_d
+    const bool widen = state_precision == PrecisionMode::Float;
+    const bool narrow = precision == PrecisionMode::Float;
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, widen, narrow](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            if (widen) {
+                points_d.Set(i, glm::dvec3(points.Get(i)));
+                velocity_d.Set(i, glm::dvec3(velocity.Get(i)));
+            } else if (narrow) {
+                velocity.Set(i, glm::vec3(velocity_d.Get(i)));
+            }
+        }
+    });
+    state_precision = precision;
+    acceleration_clear = false;
+}
+
+void Tofu::ClearAcceleration() {
+    SyncPrecision();
+    // Double accumulates in acceleration_d, under any Assembly
+    if (state_precision == PrecisionMode::Double) {
+        if (acceleration_clear) return;
+        Pool->ParallelFor(0, PointNum, PointGrain, [this](int begin, int end) {
+            std::fill(acceleration_d.x + begin, acceleration_d.x + end, 0.0);
+            std::fill(acceleration_d.y + begin, acceleration_d.y + end, 0.0);
+            std::fill(acceleration_d.z + begin, acceleration_d.z + end, 0.0);
+        });
+        acceleration_clear = true;
+        return;
+    }
+    // Gather overwrites every force buffer entry; the point update zeroes what it reads
+    if (Assembly == AssemblyMode::Gather || acceleration_clear) return;
+    Pool->ParallelFor(0, PointNum, PointGrain, [this](int begin, int end) {
+        std::fill(acceleration.x + begin, acceleration.x + end, 0.0f);
+        std::fill(acceleration.y + begin, acceleration.y + end, 0.0f);
+        std::fill(acceleration.z + begin, acceleration.z + end, 0.0f);
+    });
+    acceleration_clear = true;
+}
+
+void Tofu::SolveElements() {
+    KernelParams params = {StressMu, StressLambda, 1.0f / PointMass, CollectStats};
+    const TetrahedraRest* rest = tet_rest.Get();
+    SyncPrecision();
+    step_strain = 0.0f;
+    ResetStats();
+    // Double has no force buffer kernel, it scatters by color under Gather too
+    if (Assembly == AssemblyMode::Gather && state_precision != PrecisionMode::Double) {
+        ForceBlocksFunc force_blocks = GetForceBlocks(Isa, Material);
+        // Blocks write disjoint force buffers, no coloring needed
+        float* force = tet_force.Get();
+        Pool->ParallelFor(0, tetrahedra_block_num, BlockGrain, [&](int begin, int end) {
+            BlockStats stats = ForBlocks(begin, end, [&](const TetrahedraBlock* blocks, int first, int num) {
+                return force_blocks(blocks, rest, 0, num, points, params, force + (size_t) first * TetrahedraForceSize);
+            });
+            AtomicMax(step_strain, stats.max_strain);
+            SetChunkEnergy(begin, stats.energy);
+        });
+        return;
+    }
+
+    SolveBlocksFunc solve_blocks = GetSolveBlocks(Isa, Material);
+    acceleration_clear = false;
+    for (int c = 0; c < color_num; ++c) {
+        Pool->ParallelFor(color_block_begin[c], color_block_begin[c + 1], BlockGrain,
+                          [&](int begin, int end) {
+            BlockStats stats = SolveBlockRange(begin, end, params, solve_blocks);
+            AtomicMax(step_strain, stats.max_strain);
+            SetChunkEnergy(begin, stats.energy);
+        });
+    }
+}
+
+BlockStats Tofu::SolveBlockRange(int begin, int end, const KernelParams& params, SolveBlocksFunc solve_blocks) {
+    const TetrahedraRest* rest = tet_rest.Get();
+    if (state_precision == PrecisionMode::Double) {
+        SolveBlocksDoubleFunc solve_blocks_d = GetSolveBlocksDouble(Material);
+        return ForBlocks(begin, end, [&](const TetrahedraBlock* blocks, int, int num) {
+            return solve_blocks_d(blocks, rest, 0, num, points_d, params, acceleration_d);
+        });
+    }
+    return ForBlocks(begin, end, [&](const TetrahedraBlock* blocks, int, int num) {
+        return solve_blocks(blocks, rest, 0, num, points, params, acceleration);
+    });
+}
+
+StepStatus Tofu::UpdateParams(float dt) {
+    return IntegrateExplicit(dt);
+}
+
+StepStatus Tofu::IntegrateExplicit(float dt) {
+    point_chunk_num = (PointNum + PointGrain - 1) / PointGrain;
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, dt](int begin, int end) {
+        UpdateChunk(begin / PointGrain, begin, end, dt);
+    });
+    acceleration_clear = Assembly != AssemblyMode::Gather || state_precision == PrecisionMode::Double;
+    SumStats();
+    return CheckHealth();
+}
+
+// Slabs of one parity share no points: a task per slab scatters its blocks of the 4 colors of
+// that parity in order, even slabs first. Odd slab s is then the last to touch point planes s and
+// s + 1, its task integrates them while they are still in cache. The planes next to no odd slab
+// (0, and iNum if iNum is odd) are integrated last
+StepStatus Tofu::StepFused(float dt) {
+    KernelParams params = {StressMu, StressLambda, 1.0f / PointMass, CollectStats};
+    SolveBlocksFunc solve_blocks = GetSolveBlocks(Isa, Material);
+    const int plane_size = (jNum + 1) * (kNum + 1);
+    ClearAcceleration();
+    step_strain = 0.0f;
+    ResetStats();
+    point_chunk_num = iNum + 1;
+    auto integrate_plane = [this, plane_size, dt](int plane) {
+        UpdateChunk(plane, plane * plane_size, (plane + 1) * plane_size, dt);
+    };
+
+    for (int parity = 0; parity < 2; ++parity) {
+        Pool->ParallelFor(0, ParityCount(iNum, parity), 1, [&](int begin, int end) {
+            for (int n = begin; n < end; ++n) {
+                int slab = 2 * n + parity;
+                for (int c = parity; c < LatticeColorNum; c += 2) {
+                    int first = slab_block_begin[c * iNum + slab];
+                    int last = slab_block_begin[c * iNum + slab + 1];
+                    if (first == last) continue;
+                    BlockStats stats = SolveBlockRange(first, last, params, solve_blocks);
+                    AtomicMax(step_strain, stats.max_strain);
+                    SetChunkEnergy(first, stats.energy);
+                }
+                if (parity == 1) {
+                    integrate_plane(slab);
+                    integrate_plane(slab + 1);
+                }
+            }
+        });
+    }
+    int rest_planes[2] = {0, iNum};
+    Pool->ParallelFor(0, iNum % 2 == 1 ? 2 : 1, 1, [&](int begin, int end) {
+        for (int n = begin; n < end; ++n) {
+            integrate_plane(rest_planes[n]);
+        }
+    });
+    acceleration_clear = true;
+    SumStats();
+    return CheckHealth();
+}
+
+// Time skewing: slab s at level l (after l steps) reads point planes s and s + 1 at level l and
+// adds into them, plane p moves to level l + 1 once slabs p - 1 and p are done at level l. So the
+// slabs one level up are one fewer on each side: a tile of slabs [a, b) runs its triangle alone,
+// slabs [a + 1 + l, b - 1 - l) and planes [a + 2 + l, b - 1 - l) at level l, which touch no plane
+// of another tile; the lattice ends have no neighbor to wait for. Then the valley around each
+// inner tile bound a, slabs [a - 1 - l, a + 1 + l) and planes [a - 1 - l, a + 1 + l] at level l,
+// runs alone; tiles of 2 steps + 1 slabs keep the valleys apart. Each triangle and valley stays
+// in cache over its steps: the state streams through memory twice per batch instead of each step
+StepStatus Tofu::StepTemporal(float dt, int steps) {
+    KernelParams params = {StressMu, StressLambda, 1.0f / PointMass, CollectStats};
+    SolveBlocksFunc solve_blocks = GetSolveBlocks(Isa, Material);
+    const int plane_size = (jNum + 1) * (kNum + 1);
+    ClearAcceleration();
+    step_strain = 0.0f;
+    ResetStats();
+    point_chunk_num = iNum + 1;
+    // Slabs [slab_begin, slab_end) at one level, then planes [plane_begin, plane_end) one level up
+    auto advance = [&](int slab_begin, int slab_end, int plane_begin, int plane_end) {
+        for (int slab = slab_begin; slab < slab_end; ++slab) {
+            for (int c = slab & 1; c < LatticeColorNum; c += 2) {
+                int first = slab_block_begin[c * iNum + slab];
+                int last = slab_block_begin[c * iNum + slab + 1];
+                if (first == last) continue;
+                BlockStats stats = SolveBlockRange(first, last, params, solve_blocks);
+                AtomicMax(step_strain, stats.max_strain);
+                SetChunkEnergy(first, stats.energy);
+            }
+        }
+        for (int plane = plane_begin; plane < plane_end; ++plane) {
+            UpdateChunk(plane, plane * plane_size, (plane + 1) * plane_size, dt);
+        }
+    };
+
+    const int tile_num = std::max(1, iNum / (2 * steps + 1));
+    Pool->ParallelFor(0, tile_num, 1, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            int a = t * iNum / tile_num, b = (t + 1) * iNum / tile_num;
+            for (int level = 0; level < steps; ++level) {
+                advance(a == 0 ? 0 : a + 1 + level, b == iNum ? iNum : b - 1 - level,
+                        a == 0 ? 0 : a + 2 + level, b == iNum ? iNum + 1 : b - 1 - level);
+            }
+        }
+    });
+    Pool->ParallelFor(1, tile_num, 1, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            int a = t * iNum / tile_num;
+            for (int level = 0; level < steps; ++level) {
+                advance(a - 1 - level, a + 1 + level, a - 1 - level, a + 2 + level);
+            }
+        }
+    });
+    acceleration_clear = true;
+    SumStats();
+    return CheckHealth();
+}
+
+int Tofu::TemporalBatch() const {
+    bool temporal = Integrator == IntegratorMode::Explicit && Assembly == AssemblyMode::Temporal && lattice &&
+                    point_ordering == PointOrdering::Lattice;
+    return temporal ? std::max(1, TemporalSteps) : 1;
+}
+
+void Tofu::UpdateChunk(int chunk, int begin, int end, float dt) {
+    switch (state_precision) {
+    case PrecisionMode::Mixed:
+        UpdateChunkOf<PrecisionMode::Mixed>(chunk, begin, end, dt);
+        break;
+    case PrecisionMode::Double:
+        UpdateChunkOf<PrecisionMode::Double>(chunk, begin, end, dt);
+        break;
+    default:
+        UpdateChunkOf<PrecisionMode::Float>(chunk, begin, end, dt);
+    }
+}
+
+template <PrecisionMode Mode>
+void Tofu::UpdateChunkOf(int chunk, int begin, int end, float dt) {
+    if (Assembly == AssemblyMode::Gather && Mode != PrecisionMode::Double) {
+        CollectStats ? UpdatePoints<Mode, true, true>(chunk, begin, end, dt)
+                     : UpdatePoints<Mode, true, false>(chunk, begin, end, dt);
+    } else {
+        CollectStats ? UpdatePoints<Mode, false, true>(chunk, begin, end, dt)
+                     : UpdatePoints<Mode, false, false>(chunk, begin, end, dt);
+    }
+}
+
+StepStatus Tofu::CheckHealth() {
+    // Fixed chunk order, same result for any thread number
+    float sum = 0.0f;
+    float max_speed2 = 0.0f;
+    for (int n = 0; n < point_chunk_num; ++n) {
+        const ChunkHealth& health = chunk_health[n];
+        sum += health.sum;
+        max_speed2 = std::max(max_speed2, health.max_speed2);
+    }
+    Health.max_speed = std::sqrt(max_speed2);
+    Health.max_strain = step_strain;
+    if (!std::isfinite(sum)) {
+        Health.status = StepStatus::NonFinite;
+    } else if (Health.max_speed > SpeedLimit) {
+        Health.status = StepStatus::SpeedLimit;
+    } else if (Health.max_strain > StrainLimit) {
+        Health.status = StepStatus::StrainLimit;
+    } else {
+        Health.status = StepStatus::Ok;
+    }
+    return Health.status;
+}
+
+void Tofu::ResetStats() {
+    if (CollectStats) std::fill(chunk_energy.begin(), chunk_energy.end(), 0.0f);
+}
+
+void Tofu::SumStats() {
+    if (!CollectStats) return;
+    // Fixed chunk order, same result for any thread number
+    double speed2 = 0.0, elastic = 0.0;
+    glm::dvec3 position(0.0), momentum(0.0), moment(0.0);
+    for (int n = 0; n < point_chunk_num; ++n) {
+        const ChunkStats& stats = chunk_stats[n];
+        speed2 += stats.speed2;
+        position += stats.position;
+        momentum += stats.velocity;
+        moment += stats.moment;
+    }
+    for (float energy : chunk_energy) {
+        elastic += energy;
+    }
+    double mass = PointMass;
+    Stats.kinetic = 0.5 * mass * speed2;
+    Stats.elastic = mass * elastic;
+    Stats.potential = -mass * glm::dot(glm::dvec3(ConstantAcceleration), position);
+    Stats.energy = Stats.kinetic + Stats.elastic + Stats.potential;
+    Stats.momentum = mass * momentum;
+    Stats.angular_momentum = mass * moment;
+}
+
+// Linearized backward Euler
+// v' = v + dv, x' = x + dt v', with (I - dt^2 K) dv = dt (a(x) + g) + dt^2 K v
+StepStatus Tofu::StepImplicit(float dt) {
+    StoreBlocks();
+    SyncPrecision();
+    const bool matrix_free = Integrator == IntegratorMode::ImplicitMatrixFree;
+
+    if ((int) implicit_v.size() != PointNum) {
+        system_inv_diag.resize(PointNum);
+        implicit_v.resize(PointNum);
+        implicit_rhs.resize(PointNum);
+        implicit_dv.resize(PointNum);
+    }
+    if (matrix_free) {
+        tet_F.resize((size_t) tetrahedra_block_num * TetrahedraBlockSize);
+        tet_stress.resize(tet_F.size());
+    } else if (system.RowNum() != PointNum) {
+        system.BuildPattern(tet_blocks.Get(), tetrahedra_block_num, PointNum);
+        // Block index of every corner pair, looked up once instead of per step
+        system_block_index.resize((size_t) tetrahedra_block_num * TetrahedraBlockSize * 16);
+        Pool->ParallelFor(0, tetrahedra_block_num, BlockGrain, [this](int begin, int end) {
+            for (int b = begin; b < end; ++b) {
+                const TetrahedraBlock& blk = tet_blocks[b];
+                for (int lane = 0; lane < blk.num; ++lane) {
+                    int* index = &system_block_index[((size_t) b * TetrahedraBlockSize + lane) * 16];
+                    for (int a = 0; a < 4; ++a) {
+                        for (int c = 0; c < 4; ++c) {
+                            index[a * 4 + c] = system.Find(blk.m[a][lane], blk.m[c][lane]);
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    Pool->ParallelFor(0, PointNum, PointGrain, [this](int begin, int end) {
+        std::fill(acceleration.x + begin, acceleration.x + end, 0.0f);
+        std::fill(acceleration.y + begin, acceleration.y + end, 0.0f);
+        std::fill(acceleration.z + begin, acceleration.z + end, 0.0f);
+        std::fill(system_inv_diag.begin() + begin, system_inv_diag.begin() + end, glm::mat3(0.0f));
+        for (int i = begin; i < end; ++i) {
+            implicit_v[i] = velocity.Get(i);
+        }
+    });
+    acceleration_clear = false;
+    if (!matrix_free) {
+        system.SetZero(*Pool);
+    }
+
+    // a(x) and -dt^2 K (matrix-free: its diagonal blocks only)
+    // Blocks of a color share no points, so neither block rows
+    KernelParams params = {StressMu, StressLambda, 1.0f / PointMass, CollectStats};
+    BlockStats (Tofu::*assemble)(int, int, const KernelParams&, float, bool) = &Tofu::AssembleImplicit<StvkMaterial>;
+    switch (Material) {
+    case MaterialModel::StableNeoHookean:
+        assemble = &Tofu::AssembleImplicit<StableNeoHookeanMaterial>;
+        break;
+    case MaterialModel::Corotated:
+        assemble = &Tofu::AssembleImplicit<CorotatedMaterial>;
+        break;
+    case MaterialModel::Linear:
+        assemble = &Tofu::AssembleImplicit<LinearMaterial>;
+        break;
+    default:
+        break;
+    }
+    step_strain = 0.0f;
+    ResetStats();
+    for (int c = 0; c < color_num; ++c) {
+        Pool->ParallelFor(color_block_begin[c], color_block_begin[c + 1], BlockGrain,
+                          [&](int begin, int end) {
+            BlockStats stats = (this->*assemble)(begin, end, params, dt, matrix_free);
+            AtomicMax(step_strain, stats.max_strain);
+            SetChunkEnergy(begin, stats.energy);
+        });
+    }
+
+    // Add I, invert the diagonal blocks for the preconditioner
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, matrix_free](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            glm::mat3& diag = matrix_free ? system_inv_diag[i] : system.Block(system.Diagonal(i));
+            diag += glm::mat3(1.0f);
+            system_inv_diag[i] = glm::inverse(diag);
+        }
+    });
+
+    LinearOperator apply;
+    if (matrix_free) {
+        apply = [this, &params, dt](const glm::vec3* x, glm::vec3* y) {
+            ApplyImplicit(x, y, params, dt);
+        };
+    } else {
+        apply = [this](const glm::vec3* x, glm::vec3* y) {
+            system.Multiply(*Pool, x, y);
+        };
+    }
+
+    // rhs = dt (a + g) + v - (I - dt^2 K) v
+    apply(implicit_v.data(), implicit_rhs.data());
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, dt](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            implicit_rhs[i] = dt * (acceleration.Get(i) + ConstantAcceleration) + implicit_v[i] - implicit_rhs[i];
+            implicit_dv[i] = glm::vec3(0.0f);
+        }
+    });
+
+    CgResult result = ConjugateGradient(*Pool, apply, system_inv_diag.data(), implicit_rhs.data(),
+                                        implicit_dv.data(), PointNum, SolverMaxIterations, SolverTolerance,
+                                        cg_workspace);
+    SolverIterations = result.iterations;
+
+    point_chunk_num = (PointNum + PointGrain - 1) / PointGrain;
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, dt](int begin, int end) {
+        ChunkHealth health = {0.0f, 0.0f};
+        ChunkStats stats = ChunkStats();
+        for (int i = begin; i < end; ++i) {
+            glm::vec3 v_out = implicit_v[i] + implicit_dv[i];
+
+            // Simple damping
+            v_out *= 0.999f;
+
+            glm::vec3 p = points.Get(i);
+            if (CollectStats) AddStats(stats, p, implicit_v[i]);
+            p += v_out * dt;
+            if (p.y < 0.0f) {
+                p.y = 0.0f;
+                v_out.y = 0.0f;
+            }
+            points.Set(i, p);
+            velocity.Set(i, v_out);
+            AddHealth(health, p, v_out);
+        }
+        chunk_health[begin / PointGrain] = health;
+        chunk_stats[begin / PointGrain] = stats;
+    });
+    SumStats();
+    return CheckHealth();
+}
+
+// Element force and stiffness of blocks [begin, end), scattered into acceleration and
+// system, or (matrix-free) the diagonal blocks into system_inv_diag, keeping F and stress
+// Returns the largest strain norm of the blocks and, with params.energy, their elastic energy
+template <class Material>
+BlockStats Tofu::AssembleImplicit(int begin, int end, const KernelParams& params, float dt, bool matrix_free) {
+    float dt2 = dt * dt;
+    float max_strain2 = 0.0f;
+    float energy = 0.0f;
+    for (int b = begin; b < end; ++b) {
+        const TetrahedraBlock& blk = tet_blocks[b];
+        const TetrahedraRest& blk_rest = tet_rest[blk.rest];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            size_t t = (size_t) b * TetrahedraBlockSize + lane;
+            int m[4] = {blk.m[0][lane], blk.m[1][lane], blk.m[2][lane], blk.m[3][lane]};
+            glm::vec3 x[4] = {points.Get(m[0]), points.Get(m[1]), points.Get(m[2]), points.Get(m[3])};
+            glm::mat3 inv_R = blk_rest.GetInvR(lane);
+            glm::vec3 norm[3] = {blk_rest.GetNorm(0, lane), blk_rest.GetNorm(1, lane), blk_rest.GetNorm(2, lane)};
+
+            glm::vec3 f[4];
+            glm::mat3 F, stress;
+            glm::mat3 K[16];
+            max_strain2 = std::max(max_strain2, TetrahedraForce<Material>(x, inv_R, norm, params, f));
+            if (params.energy) energy += TetrahedraEnergy<Material>(x, inv_R, params);
+            TetrahedraLinearize<Material>(x, inv_R, params, F, stress);
+            TetrahedraStiffness(F, stress, inv_R, norm, params, K);
+            for (int a = 0; a < 4; ++a) {
+                acceleration.Add(m[a], f[a]);
+            }
+            if (matrix_free) {
+                tet_F[t] = F;
+                tet_stress[t] = stress;
+                for (int a = 0; a < 4; ++a) {
+                    system_inv_diag[m[a]] -= dt2 * K[a * 5];
+                }
+                continue;
+            }
+            const int* index = &system_block_index[t * 16];
+            for (int a = 0; a < 16; ++a) {
+                system.Block(index[a]) -= dt2 * K[a];
+            }
+        }
+    }
+    return {std::sqrt(max_strain2), energy};
+}
+
+// y = (I - dt^2 K) x, element by element at the F and stress kept by AssembleImplicit
+void Tofu::ApplyImplicit(const glm::vec3* x, glm::vec3* y, const KernelParams& params, float dt) {
+    float dt2 = dt * dt;
+    Pool->ParallelFor(0, PointNum, PointGrain, [x, y](int begin, int end) {
+        std::copy(x + begin, x + end, y + begin);
+    });
+    for (int c = 0; c < color_num; ++c) {
+        Pool->ParallelFor(color_block_begin[c], color_block_begin[c + 1], BlockGrain,
+                          [&](int begin, int end) {
+            for (int b = begin; b < end; ++b) {
+                const TetrahedraBlock& blk = tet_blocks[b];
+                const TetrahedraRest& blk_rest = tet_rest[blk.rest];
+                for (int lane = 0; lane < blk.num; ++lane) {
+                    size_t t = (size_t) b * TetrahedraBlockSize + lane;
+                    int m[4] = {blk.m[0][lane], blk.m[1][lane], blk.m[2][lane], blk.m[3][lane]};
+                    glm::vec3 dx[4] = {x[m[0]], x[m[1]], x[m[2]], x[m[3]]};
+                    glm::vec3 norm[3] = {blk_rest.GetNorm(0, lane), blk_rest.GetNorm(1, lane), blk_rest.GetNorm(2, lane)};
+                    glm::vec3 df[4];
+                    TetrahedraForceDifferential(dx, tet_F[t], tet_stress[t], blk_rest.GetInvR(lane), norm, params, df);
+                    for (int a = 0; a < 4; ++a) {
+                        y[m[a]] -= dt2 * df[a];
+                    }
+                }
+            }
+        });
+    }
+}
+
+// Projective Dynamics (Bouaziz et al. 2014)
+// Minimizes |x - s|_M^2 / (2 dt^2) + sum w / 2 |F(x) - p|^2 by alternating the projections p
+// (local, per tetrahedra) with M / dt^2 x + sum w G^T G x = M / dt^2 s + sum w G^T p (global)
+StepStatus Tofu::StepProjective(float dt) {
+    StoreBlocks();
+    SyncPrecision();
+    if ((int) projective_x.size() != PointNum) {
+        projective_s.resize(PointNum);
+        projective_x.resize(PointNum);
+        projective_rhs.resize(PointNum);
+    }
+    glm::vec4 key(dt, StressMu, StressLambda, PointMass);
+    if (projective_factor.Size() != PointNum || key != projective_key) {
+        // Not positive definite (negative material constants): fail the step, factor again next time
+        if (!FactorProjective(dt)) {
+            projective_key = glm::vec4(0.0f);
+            Health.status = StepStatus::NonFinite;
+            return Health.status;
+        }
+        projective_key = key;
+    }
+
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, dt](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            projective_s[i] = points.Get(i) + dt * velocity.Get(i) + dt * dt * ConstantAcceleration;
+            projective_x[i] = projective_s[i];
+        }
+    });
+
+    // No Material energy here: Stats.elastic stays 0
+    ResetStats();
+    float inertia = PointMass / (dt * dt);
+    for (int it = 0; it < ProjectiveIterations; ++it) {
+        Pool->ParallelFor(0, PointNum, PointGrain, [this, inertia](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                projective_rhs[i] = inertia * projective_s[i];
+            }
+        });
+        // Blocks of a color share no points, so the scatter into projective_rhs is race-free
+        // Strain is that of the last local step
+        const bool measure = it == ProjectiveIterations - 1;
+        step_strain = 0.0f;
+        for (int c = 0; c < color_num; ++c) {
+            Pool->ParallelFor(color_block_begin[c], color_block_begin[c + 1], BlockGrain,
+                              [this, measure](int begin, int end) {
+                float max_strain2 = ProjectBlocks(begin, end, measure);
+                if (measure) AtomicMax(step_strain, std::sqrt(max_strain2));
+            });
+        }
+        projective_factor.Solve(projective_rhs.data(), projective_x.data());
+    }
+    SolverIterations = ProjectiveIterations;
+
+    point_chunk_num = (PointNum + PointGrain - 1) / PointGrain;
+    Pool->ParallelFor(0, PointNum, PointGrain, [this, dt](int begin, int end) {
+        ChunkHealth health = {0.0f, 0.0f};
+        ChunkStats stats = ChunkStats();
+        for (int i = begin; i < end; ++i) {
+            glm::vec3 p = projective_x[i];
+            glm::vec3 v_out = (p - points.Get(i)) / dt;
+            if (CollectStats) AddStats(stats, points.Get(i), velocity.Get(i));
+
+            // Simple damping
+            v_out *= 0.999f;
+
+            if (p.y < 0.0f) {
+                p.y = 0.0f;
+                v_out.y = 0.0f;
+            }
+            points.Set(i, p);
+            velocity.Set(i, v_out);
+            AddHealth(health, p, v_out);
+        }
+        chunk_health[begin / PointGrain] = health;
+        chunk_stats[begin / PointGrain] = stats;
+    });
+    SumStats();
+    return CheckHealth();
+}
+
+// Global matrix M / dt^2 + sum w G^T G, G^T G(a, b) = grad(a) . grad(b) per axis
+bool Tofu::FactorProjective(float dt) {
+    std::vector<int> row_begin, col;
+    BuildPointPattern(tet_blocks.Get(), tetrahedra_block_num, PointNum, row_begin, col);
+    std::vector<double> value(col.size(), 0.0);
+    std::vector<glm::vec3> coord(PointNum);
+    for (int i = 0; i < PointNum; ++i) {
+        coord[i] = points.Get(i);
+        value[std::lower_bound(col.begin() + row_begin[i], col.begin() + row_begin[i + 1], i) - col.begin()] +=
+            PointMass / ((double) dt * dt);
+    }
+    for (int b = 0; b < tetrahedra_block_num; ++b) {
+        const TetrahedraBlock& blk = tet_blocks[b];
+        const TetrahedraRest& blk_rest = tet_rest[blk.rest];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            glm::mat3 inv_RT = glm::transpose(blk_rest.GetInvR(lane));
+            glm::vec3 grad[4] = {inv_RT[0], inv_RT[1], inv_RT[2], -(inv_RT[0] + inv_RT[1] + inv_RT[2])};
+            float w = ProjectiveWeight(blk_rest.GetInvR(lane));
+            for (int a = 0; a < 4; ++a) {
+                int row = blk.m[a][lane];
+                for (int c = 0; c < 4; ++c) {
+                    int e = (int) (std::lower_bound(col.begin() + row_begin[row], col.begin() + row_begin[row + 1],
+                                                    blk.m[c][lane]) - col.begin());
+                    value[e] += (double) w * glm::dot(grad[a], grad[c]);
+                }
+            }
+        }
+    }
+    return projective_factor.Factor(PointNum, row_begin, col, value, coord.data());
+}
+
+float Tofu::ProjectBlocks(int begin, int end, bool measure) {
+    float two_mu = 2.0f * StressMu;
+    float lambda = StressLambda;
+    float max_strain2 = 0.0f;
+    for (int b = begin; b < end; ++b) {
+        const TetrahedraBlock& blk = tet_blocks[b];
+        const TetrahedraRest& blk_rest = tet_rest[blk.rest];
+        for (int lane = 0; lane < blk.num; ++lane) {
+            int m[4] = {blk.m[0][lane], blk.m[1][lane], blk.m[2][lane], blk.m[3][lane]};
+            glm::mat3 inv_R = blk_rest.GetInvR(lane);
+            glm::vec3 x4 = projective_x[m[3]];
+            glm::mat3 F = glm::mat3(projective_x[m[0]] - x4, projective_x[m[1]] - x4, projective_x[m[2]] - x4) * inv_R;
+            if (measure) max_strain2 = std::max(max_strain2, TetrahedraStrain2(F));
+
+            // Strain: nearest rotation U V^T; volume: singular values scaled to det 1
+            // Blend weighted by 2 mu and lambda, w carries their sum
+            glm::mat3 U, V;
+            glm::vec3 sigma;
+            Svd3(F, U, sigma, V);
+            glm::vec3 s_vol = glm::max(sigma, glm::vec3(1e-3f));
+            s_vol /= std::cbrt(s_vol.x * s_vol.y * s_vol.z);
+            glm::vec3 s_target = (two_mu * glm::vec3(1.0f) + lambda * s_vol) / (two_mu + lambda);
+            glm::mat3 S(0.0f);
+            S[0][0] = s_target.x;
+            S[1][1] = s_target.y;
+            S[2][2] = s_target.z;
+            glm::mat3 P = ProjectiveWeight(inv_R) * (U * S * glm::transpose(V));
+
+            glm::mat3 inv_RT = glm::transpose(inv_R);
+            glm::vec3 grad[3] = {inv_RT[0], inv_RT[1], inv_RT[2]};
+            glm::vec3 f[3] = {P * grad[0], P * grad[1], P * grad[2]};
+            projective_rhs[m[0]] += f[0];
+            projective_rhs[m[1]] += f[1];
+            projective_rhs[m[2]] += f[2];
+            projective_rhs[m[3]] -= f[0] + f[1] + f[2];
+        }
+    }
+    return max_strain2;
+}
+
+// Integrate points [begin, end) in place, their partials into chunk
+// Gather: acceleration is summed from the force buffer here, fused with the update
+// Otherwise acceleration is zeroed as it is read, ready for the next scatter
+// Mixed / Double: the state is read and written in double, points gets its float copy
+template <PrecisionMode Mode, bool Gather, bool Stats>
+void Tofu::UpdatePoints(int chunk, int begin, int end, float dt) {
+    typedef typename std::conditional<Mode == PrecisionMode::Float, float, double>::type Scalar;
+    typedef glm::vec<3, Scalar> Vec;
+    const bool wide = Mode != PrecisionMode::Float;
+    ChunkHealth health = {0.0f, 0.0f};
+    ChunkStats stats = ChunkStats();
+    for (int i = begin; i < end; ++i) {
+        Vec v_in = wide ? Vec(velocity_d.Get(i)) : Vec(velocity.Get(i));
+        Vec a;
+        if (Gather) {
+            a = Vec(GatherAcceleration(i));
+        } else if (Mode == PrecisionMode::Double) {
+            a = Vec(acceleration_d.Get(i));
+            acceleration_d.Set(i, glm::dvec3(0.0));
+        } else {
+            a = Vec(acceleration.Get(i));
+            acceleration.Set(i, glm::vec3(0.0f));
+        }
+        Vec p = wide ? Vec(points_d.Get(i)) : Vec(points.Get(i));
+        if (Stats) AddStats(stats, p, v_in);
+
+        // std::cout << "Point: " << i << std::endl;
+        // LogVec3("position", p);
+        // LogVec3("acceleration", a);
+
+        Vec v_out = v_in + (a + Vec(ConstantAcceleration)) * Scalar(dt);
+        
+        // Simple damping
+        v_out *= Scalar(0.999);
+
+        // Update Position
+        p += (v_in + v_out) * Scalar(dt) / Scalar(2);
+        
+        // Apply Collision to Position & Velocity (Directly Inverse)
+        if (p.y < Scalar(0)) {
+            p.y = Scalar(0);
+            v_out.y = Scalar(0);
+        }
+        if (wide) {
+            points_d.Set(i, glm::dvec3(p));
+            velocity_d.Set(i, glm::dvec3(v_out));
+        } else {
+            velocity.Set(i, glm::vec3(v_out));
+        }
+        points.Set(i, glm::vec3(p));
+        AddHealth(health, glm::vec3(p), glm::vec3(v_out));
+    }
+    chunk_health[chunk] = health;
+    if (Stats) chunk_stats[chunk] = stats;
+}
+
+// Surface plot
+// Offset = 1 x face = 18
+void Tofu::GetSurface(float* holder) {
+    for (int t = 0; t < SurfaceNum; ++t) {
+        SurfaceType& sf = surface[t];
+        // std::cout << "Get Surface id = " << t << " Done" << std::endl;
+        PutFace(points.Get(sf.m1), points.Get(sf.m2), points.Get(sf.m3), holder + t * 18);
+    }
+}
+
+void Tofu::GetSurfaceIndices(unsigned int* holder, unsigned int point_offset) const {
+    for (size_t n = 0; n < surface_index.size(); ++n) {
+        holder[n] = point_offset + surface_index[n];
+    }
+}
+
+void Tofu::GetSurfacePositions(float* holder) const {
+    const int* point = surface_point.data();
+    Pool->ParallelFor(0, SurfacePointNum, PointGrain, [this, point, holder](int begin, int end) {
+        for (int n = begin; n < end; ++n) {
+            int p = point[n];
+            holder[n * 3] = points.x[p];
+            holder[n * 3 + 1] = points.y[p];
+            holder[n * 3 + 2] = points.z[p];
+        }
+    });
+}
+
+// Tetrahedra plot
+// Offset 4 * face = 4 * 18 = 72
+void Tofu::GetTetrahedra(float* holder) {
+    for (int t = 0; t < TetrahedraNum; ++t) {
+        TetrahedraType th = TetrahedraOf(t);
+        float* cur_holder = holder + t * 72;
+
+        // 1
+        PutFace(points.Get(th.m1), points.Get(th.m2), points.Get(th.m3), cur_holder);
+        cur_holder += 18;
+        
+        // 2
+        PutFace(points.Get(th.m3), points.Get(th.m2), points.Get(th.m4), cur_holder);
+        cur_holder += 18;
+        
+        // 3
+        PutFace(points.Get(th.m4), points.Get(th.m1), points.Get(th.m3), cur_holder);
+        cur_holder += 18;
+        
+        // 4
+        PutFace(points.Get(th.m2), points.Get(th.m1), points.Get(th.m4), cur_holder);
+        cur_holder += 18;
+    }
+}
+
+}  // namespace model
@@ -1,9 +1,20 @@
 #ifndef TOFU_H_
 #define TOFU_H_
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <cmath>
+#include <string>
+#include <iostream>
+#include <vector>
 #include <glm/glm.hpp>
+#include "kernel.h"
+#include "mesh.h"
+#include "ordering.h"
+#include "soa.h"
+#include "solver.h"
+#include "thread_pool.h"
 
 namespace model {
 struct TetrahedraType {
@@ -14,6 +25,70 @@ struct SurfaceType {
     int m1, m2, m3;
 };
 
+// How per-tetrahedra forces reach the points
+enum class AssemblyMode {
+    Scatter,  // colored blocks add into acceleration
+    Gather,  // per-tetrahedra force buffer, each point sums its own corners
+    Fused,  // Scatter by slabs, explicit Step integrates each point plane right after its last slab;
+            // needs the planes of PointOrdering::Lattice, steps as Scatter under another ordering
+    Temporal,  // Fused, TemporalSteps steps at a time tile by tile while the tile is in cache
+};
+
+// Time integration of Step
+enum class IntegratorMode {
+    Explicit,  // trapezoidal update from the elastic acceleration
+    Implicit,  // linearized backward Euler, (I - dt^2 K) dv = dt (a + dt K v), solved by CG
+    ImplicitMatrixFree,  // Implicit without an assembled K, CG runs on per-tetrahedra K dx
+    Projective,  // Projective Dynamics, per-tetrahedra projections + prefactored global solve
+};
+
+// Scalar type of the explicit state and arithmetic
+enum class PrecisionMode {
+    Float,  // float positions, velocities and kernels
+    Mixed,  // positions and velocities integrated in double, float (SIMD) element kernels on a float copy
+    Double,  // double state and double scalar element kernels
+};
+
+// Outcome of a step, from the health monitor fused into its integration passes
+enum class StepStatus {
+    Ok,
+    NonFinite,  // NaN / inf in a position or velocity
+    SpeedLimit,  // a point faster than Tofu::SpeedLimit
+    StrainLimit,  // a tetrahedra strained past Tofu::StrainLimit
+};
+
+struct StepHealth {
+    StepStatus status;
+    float max_speed;  // largest point speed
+    float max_strain;  // largest Green strain norm |F^T F - I| / 2 of a tetrahedra
+};
+
+// Energy and momentum of the state a step started from, by-products of its element and point passes
+struct StepStats {
+    double kinetic;  // sum m |v|^2 / 2
+    double elastic;  // sum 3 V psi(F) of Material, the potential of the element forces; 0 in Projective
+    double potential;  // gravitational, -sum m g . x with g = ConstantAcceleration
+    double energy;  // kinetic + elastic + potential
+    glm::dvec3 momentum;  // sum m v
+    glm::dvec3 angular_momentum;  // sum m x * v about the origin
+};
+
+// Step / Advance: rollbacks of one step or frame before giving up, step scale growth per good one
+const int AdvanceMaxRollbacks = 8;
+const float AdvanceRecovery = 1.1f;
+// Checkpoint ring: states kept, Step calls between two saves (Advance saves every frame)
+const int CheckpointRingSize = 4;
+const int CheckpointInterval = 16;
+
+// Blocks hold whole boxes (3 boxes + 1 padding lane)
+const int BoxPerBlock = TetrahedraBlockSize / TetrahedraPerBox;
+// Boxes colored by parity of (i, j, k)
+const int LatticeColorNum = 8;
+
+// Parallel chunk sizes: points per chunk, blocks per chunk
+const int PointGrain = 4096;
+const int BlockGrain = 64;
+
 class Tofu {
 public:
     // Geometry constant
@@ -23,190 +98,138 @@ public:
     int TetrahedraNum;
     int SurfaceHolderSize;
     int TetrahedraHolderSize;
+    // Points of the surface triangles
+    int SurfacePointNum;
+    int SurfacePositionHolderSize;
 
     // Physics constant
     float PointMass;
     float StressMu;
     float StressLambda;
+    // Constitutive model of Explicit / Implicit modes, StVK by default; Projective has its own energy
+    MaterialModel Material;
     glm::vec3 StartVelocity;
     glm::vec3 ConstantAcceleration;
 
-    explicit Tofu(float unit_length, int W, int L, int H) {
-        // Geometry
-        dL = unit_length;
-        iNum = W;
-        jNum = L;
-        kNum = H;
-
-        PointNum = (W + 1) * (L + 1) * (H + 1);
-        BoxNum = W * L * H;
-        SurfaceNum = 4 * (W * L + L * H + H * W);
-        TetrahedraNum = 5 * BoxNum;
-        SurfaceHolderSize = SurfaceNum * 18;
-        TetrahedraHolderSize = TetrahedraNum * 72;
-
-        points = std::unique_ptr<glm::vec3[]>(new glm::vec3[PointNum]);
-        tetrahedra = std::unique_ptr<TetrahedraType[]>(new TetrahedraType[TetrahedraNum]);
-        surface = std::unique_ptr<SurfaceType[]>(new SurfaceType[SurfaceNum]);
-
-        // Physics
-        PointMass = 0.01f;
-        StressMu = 1.0f;
-        StressLambda = 1.0f;
-        StartVelocity = glm::vec3(0.0f, 0.0f, 0.0f);
-        ConstantAcceleration = glm::vec3(0.0f, -9.8f, 0.0f);
-
-        velocity = std::unique_ptr<glm::vec3[]>(new glm::vec3[PointNum * 2]);
-        acceleration = std::unique_ptr<glm::vec3[]>(new glm::vec3[PointNum]);
-        
-        inv_R = std::unique_ptr<glm::mat3[]>(new glm::mat3[TetrahedraNum * 4]); // R^-1 rest state
-        norm_star = std::unique_ptr<glm::vec3[]>(new glm::vec3[TetrahedraNum * 4]); // norm^* rest state
-    }
+    // Lattice: blocks of the same number of boxes share one rest state, computed from the box at
+    // the origin, true by default; so BoxPerBlock TetrahedraRest serve any grid instead of one per
+    // block. Rest states of other boxes differ only by the rounding of their positions
+    // A mesh stores one TetrahedraRest per block
+    bool CompactRest;
+    // Lattice under PointOrdering::Lattice: no stored connectivity, the corners of each block are
+    // computed from its box (i, j, k) right before the element kernels, true by default
+    // Implicit and projective steps store the blocks on their first step
+    bool ImplicitTopology;
+    // Point numbering of Initialize, Lattice by default
+    // Tetrahedra, surface triangles and blocks follow the boxes in the order of their first point
+    PointOrdering Ordering;
+    // Tetrahedra loop instruction set, DetectSimdIsa() by default
+    SimdIsa Isa;
+    // Worker threads of Step, ThreadPool::Default() by default
+    ThreadPool* Pool;
+    // Force assembly, Scatter by default
+    // Gather does not need ClearAcceleration and integrates points as it sums them
+    AssemblyMode Assembly;
+    // Temporal: explicit steps per sweep of the lattice (4 by default), the substeps of Advance or
+    // the steps of Step(dt, steps) go in batches of it; the health is checked once per batch
+    int TemporalSteps;
+    // Time integration, Explicit by default
+    // Implicit stays stable at frame-sized dt for stiff materials, at the cost of a linear solve
+    // ImplicitMatrixFree keeps memory O(points + tetrahedra), for meshes too large for K
+    IntegratorMode Integrator;
+    // Explicit state precision, Float by default
+    // Mixed keeps the integration error of long runs down at about the cost of Float; the other
+    // integrators compute in float from a float copy of the state
+    PrecisionMode Precision;
+    // Implicit modes: CG iteration cap and relative residual
+    int SolverMaxIterations;
+    float SolverTolerance;
+    // Implicit modes: CG iterations of the last Step; Projective: local / global iterations
+    int SolverIterations;
+    // Projective: local / global iterations per Step
+    int ProjectiveIterations;
+    // Advance: safety factor of StableTimeStep (0.1), substep cap per frame (64)
+    int MaxSubsteps;
+    float CourantNumber;
+    // Step / Advance: substeps and rollbacks of the last call
+    int Substeps;
+    int Rollbacks;
+    // Health limits, a step past them fails like a non-finite one
+    // SpeedLimit: infinite by default; StrainLimit: 10 (4.6x stretch), long before float overflow
+    float SpeedLimit;
+    float StrainLimit;
+    // Health of the last step (substep of Advance)
+    StepHealth Health;
+    // Fill Stats every step, off by default; off, the passes skip all of its work
+    bool CollectStats;
+    // Stats of the last step (substep of Advance), with CollectStats
+    StepStats Stats;
+    // Simulated time since Initialize
+    double Time;
+
+    explicit Tofu(float unit_length, int W, int L, int H);
+    // Body of a loaded mesh, see LoadMesh; tetrahedra are reoriented as the lattice ones and need
+    // a volume, LoadMesh rejects degenerate ones
+    // The surface is the boundary of the tetrahedra, extracted on pool, which becomes Pool
+    // Ordering, PointOf and Fused / Temporal assembly are lattice only, a mesh keeps the numbering
+    // of its file and steps Fused / Temporal as Scatter
+    explicit Tofu(const TetMesh& mesh, ThreadPool* pool = &ThreadPool::Default());
 
     virtual ~Tofu() {}
     
-    void Initialize(glm::mat3 rotate, glm::vec3 move) {
-        int stride_i = (jNum + 1) * (kNum + 1);
-        int stride_j = kNum + 1;
-        // Initialize Position
-        for (int i = 0; i < iNum + 1; ++i) {
-            for (int j = 0; j < jNum + 1; ++j) {
-                for (int k = 0; k < kNum + 1; ++k) {
-                    points[i * stride_i + j * stride_j + k] =
-                        glm::vec3(dL * (float) i, dL * (float) j, dL * (float) k);
-                }
-            }
-        }
-
-        // Link topology
-        int surface_end = 0;
-        int tetrahedra_end = 0;
-        for (int i = 0; i < iNum; ++i) {
-            for (int j = 0; j < jNum; ++j) {
-                for (int k = 0; k < kNum; ++k) {
-                    int m1, m2, m3, m4, m5, m6, m7, m8;
-                    int start = i * stride_i + j * stride_j + k;
-                    // Link Box
-                    m1 = start;
-                    m2 = start + stride_i;
-                    m3 = start + stride_i + stride_j;
-                    m4 = start + stride_j;
-                    m5 = start + 1;
-                    m6 = start + 1 + stride_i;
-                    m7 = start + 1 + stride_i + stride_j;
-                    m8 = start + 1 + stride_j;
-                    
-                    // Link Surface (x6)
-                    LinkSurfaceIf(i, 0, m1, m5, m8, m4, surface_end);  // Front
-                    LinkSurfaceIf(i, iNum - 1, m2, m3, m7, m6, surface_end);  // Back
-                    LinkSurfaceIf(k, 0, m1, m4, m3, m2, surface_end);  // Left
-                    LinkSurfaceIf(k, kNum - 1, m5, m6, m7, m8, surface_end);  // Right
-                    LinkSurfaceIf(j, 0, m1, m2, m6, m5, surface_end);  // Down
-                    LinkSurfaceIf(j, jNum - 1, m3, m4, m8, m7, surface_end);  // Up
-                    
-                    // Link Tetrahedra (x5)
-                    LinkTetrahedra(m1, m6, m5, m8, tetrahedra_end);
-                    LinkTetrahedra(m1, m2, m6, m3, tetrahedra_end);
-                    LinkTetrahedra(m3, m4, m8, m1, tetrahedra_end);
-                    LinkTetrahedra(m3, m8, m7, m6, tetrahedra_end);
-                    LinkTetrahedra(m1, m3, m6, m8, tetrahedra_end);
-                }
-            }
-        }
-        // std::cout << "Link Surface Number: " << surface_end << std::endl;
-        // std::cout << "Link Tetrahedra Number: " << tetrahedra_end << std::endl;
-
-        // Pre-compute physical params
-        for (int i = 0; i < TetrahedraNum; ++i) {
-            TetrahedraType& th = tetrahedra[i];
-            // m4
-            inv_R[i * 4] = glm::inverse(GetFrame(th.m1, th.m2, th.m3, th.m4));
-            norm_star[i * 4] = GetNormStar(th.m1, th.m2, th.m3);
-            // m3
-            inv_R[i * 4 + 1] = glm::inverse(GetFrame(th.m1, th.m4, th.m2, th.m3));
-            norm_star[i * 4 + 1] = GetNormStar(th.m1, th.m4, th.m2);
-
-            // m2
-            inv_R[i * 4 + 2] = glm::inverse(GetFrame(th.m1, th.m3, th.m4, th.m2));
-            norm_star[i * 4 + 2] = GetNormStar(th.m1, th.m3, th.m4);
-
-            // m1
-            inv_R[i * 4 + 3] = glm::inverse(GetFrame(th.m2, th.m4, th.m3, th.m1));
-            norm_star[i * 4 + 3] = GetNormStar(th.m2, th.m4, th.m3);
-        }
-
-        // Translate & Set start velocity
-        p_in = 1;
-        p_out = 0;
-        for (int pi = 0; pi < PointNum; ++pi) {
-            points[pi] = rotate * points[pi] + move;
-
-            velocity[pi] = StartVelocity;
-            velocity[PointNum + pi] = glm::vec3(0.0f);
-        }
-    }
+    void Initialize(glm::mat3 rotate, glm::vec3 move);
 
     // Simulation
-    void Step(float dt) {
-        ClearAcceleration();
-        // For Tetrahedra
-        for (int i = 0; i < TetrahedraNum; ++i) {
-            TetrahedraType& th = tetrahedra[i];
-            // m4
-            inv_R_frame = inv_R[i * 4];
-            norm_with_area = norm_star[i * 4];
-            SolveTetrahedra(th.m1, th.m2, th.m3, th.m4);
-            // m3
-            inv_R_frame = inv_R[i * 4 + 1];
-            norm_with_area = norm_star[i * 4 + 1];
-            SolveTetrahedra(th.m1, th.m4, th.m2, th.m3);
-            // m2
-            inv_R_frame = inv_R[i * 4 + 2];
-            norm_with_area = norm_star[i * 4 + 2];
-            SolveTetrahedra(th.m1, th.m3, th.m4, th.m2);
-            // m1
-            inv_R_frame = inv_R[i * 4 + 3];
-            norm_with_area = norm_star[i * 4 + 3];
-            SolveTetrahedra(th.m2, th.m4, th.m3, th.m1);
-        }
-        UpdateParams(dt);
-        // std::cout << "dt: " << dt << std::endl;
-    }
+    // Explicit: Step = ClearAcceleration -> SolveElements -> UpdateParams
+    // Implicit modes: Step = StepImplicit; Projective: Step = StepProjective
+    // A failed step rolls back to the newest checkpoint and redoes the time since at half the
+    // step, halfway through AdvanceMaxRollbacks from the checkpoint before; then it stays at that
+    // checkpoint and returns why
+    // After a rollback dt is split in substeps until the step scale recovers
+    // steps: that many steps of dt in one call, batched under AssemblyMode::Temporal
+    StepStatus Step(float dt, int steps = 1);
     
+    // Largest stable explicit step, CFL: CourantNumber * h_min * sqrt(rho / (3 (lambda + 2 mu)))
+    // h_min: smallest rest altitude, rho: mass density; norm^* scales the StVK moduli by 3
+    float StableTimeStep() const;
+    // Advance the simulation by frame_dt in as few equal substeps as stability allows
+    // (explicit: StableTimeStep, implicit modes: one); past MaxSubsteps the rest is dropped
+    // A failed substep rolls the frame back and retries it at half the substep
+    // Returns the number of substeps, 0 if the frame failed (back at its start, Health tells why)
+    int Advance(float frame_dt);
+    // Restore the checkpoint age saves back (0: newest) and drop the newer ones
+    // False if the ring holds fewer checkpoints
+    bool Rollback(int age);
+
+    // Step phases, exposed for profiling
+    void ClearAcceleration();
+    void SolveElements();
+    StepStatus UpdateParams(float dt);
+
+    // Point index of lattice point (i, j, k), i <= W, j <= L, k <= H, under the Ordering of the
+    // last Initialize
+    inline int PointOf(int i, int j, int k) const {
+        return point_index[(i * (jNum + 1) + j) * (kNum + 1) + k];
+    }
+    // Lattice index (i * (L + 1) + j) * (H + 1) + k of point p, the inverse of PointOf
+    inline int LatticeOf(int p) const {
+        return lattice_index[p];
+    }
+
     // Surface plot
     // Offset = 1 x face = 18
-    void GetSurface(float* holder) {
-        for (int t = 0; t < SurfaceNum; ++t) {
-            SurfaceType& sf = surface[t];
-            // std::cout << "Get Surface id = " << t << " Done" << std::endl;
-            PutFace(points[sf.m1], points[sf.m2], points[sf.m3], holder + t * 18);
-        }
-    }
+    void GetSurface(float* holder);
+
+    // Indexed surface plot: the triangles once, the surface points every frame
+    // 3 surface point indices per surface triangle, plus point_offset; fixed until Ordering changes
+    void GetSurfaceIndices(unsigned int* holder, unsigned int point_offset = 0) const;
+    // Positions of the SurfacePointNum surface points, in point order, on Pool
+    // Offset = 1 x surface point = 3
+    void GetSurfacePositions(float* holder) const;
 
     // Tetrahedra plot
     // Offset 4 * face = 4 * 18 = 72
-    void GetTetrahedra(float* holder) {
-        for (int t = 0; t < TetrahedraNum; ++t) {
-            TetrahedraType& th = tetrahedra[t];
-            float* cur_holder = holder + t * 72;
-
-            // 1
-            PutFace(points[th.m1], points[th.m2], points[th.m3], cur_holder);
-            cur_holder += 18;
-            
-            // 2
-            PutFace(points[th.m3], points[th.m2], points[th.m4], cur_holder);
-            cur_holder += 18;
-            
-            // 3
-            PutFace(points[th.m4], points[th.m1], points[th.m3], cur_holder);
-            cur_holder += 18;
-            
-            // 4
-            PutFace(points[th.m2], points[th.m1], points[th.m4], cur_holder);
-            cur_holder += 18;
-        }
-    }
+    void GetTetrahedra(float* holder);
 
 private:
     // Geometry
@@ -222,96 +245,202 @@ private:
     inline void LinkTetrahedra(int m1, int m2, int m3, int m4, int& tetrahedra_end) {
         tetrahedra[tetrahedra_end++] = {m1, m2, m3, m4};
     }
-
-    // Physics
-    //------------------------------------------------------------------------------------------
-    inline glm::mat3 GetFrame(int m1, int m2, int m3, int m4) {
-        return glm::mat3(points[m1] - points[m4], points[m2] - points[m4], points[m3] - points[m4]);
+    // Number of x in [0, n) with x % 2 == parity
+    inline int ParityCount(int n, int parity) const {
+        return (n + 1 - parity) / 2;
     }
-
-    inline glm::vec3 GetNormStar(int m1, int m2, int m3) {
-        return 0.5f * glm::cross(points[m2] - points[m1], points[m3] - points[m1]);
+    // Corners of tetrahedra t into a block lane
+    inline void LinkBlockLane(TetrahedraBlock& blk, int lane, int t) {
+        const TetrahedraType& th = tetrahedra[t];
+        blk.m[0][lane] = th.m1;
+        blk.m[1][lane] = th.m2;
+        blk.m[2][lane] = th.m3;
+        blk.m[3][lane] = th.m4;
     }
-
-    inline void ClearAcceleration() {
-        for (int i = 0; i < PointNum; ++i) {
-            acceleration[i].x = acceleration[i].y = acceleration[i].z = 0.0f;
+    // Rest state of tetrahedra th into a rest lane
+    inline void LinkRestLane(TetrahedraRest& rest, int lane, const TetrahedraType& th) {
+        rest.SetInvR(lane, glm::inverse(GetFrame(th.m1, th.m2, th.m3, th.m4)));
+        // m4
+        rest.SetNorm(0, lane, GetNormStar(th.m1, th.m2, th.m3));
+        // m3
+        rest.SetNorm(1, lane, GetNormStar(th.m1, th.m4, th.m2));
+        // m2
+        rest.SetNorm(2, lane, GetNormStar(th.m1, th.m3, th.m4));
+    }
+    // Padding lanes [num, 16): corners at point 0
+    inline void PadBlock(TetrahedraBlock& blk, int num) const {
+        blk.num = num;
+        for (int lane = num; lane < TetrahedraBlockSize; ++lane) {
+            blk.m[0][lane] = blk.m[1][lane] = blk.m[2][lane] = blk.m[3][lane] = 0;
+        }
+    }
+    // Padding lanes [num, 16): identity R^-1 and zero norm^* give zero force
+    inline void PadRest(TetrahedraRest& rest, int num) {
+        for (int lane = num; lane < TetrahedraBlockSize; ++lane) {
+            rest.SetInvR(lane, glm::mat3(1.0f));
+            rest.SetNorm(0, lane, glm::vec3(0.0f));
+            rest.SetNorm(1, lane, glm::vec3(0.0f));
+            rest.SetNorm(2, lane, glm::vec3(0.0f));
         }
     }
 
-    inline void SolveTetrahedra(int m1, int m2, int m3, int m4) {
-        T_frame = GetFrame(m1, m2, m3, m4);
-        // LogMat3("inv R", inv_R_frame);
-        // LogMat3("T", T_frame);
-
-        GetStrain();
-        GetStress();
-        GetForce();
-        acceleration[m4] += f_node / PointMass;
+    // Shared by both constructors: physics defaults and the arrays of PointNum / tetrahedra_block_num
+    void Setup();
+    // surface_point and surface_index of surface, after the surface changes
+    void LinkSurfacePoints();
+    // Greedy coloring of mesh tetrahedra, no two of a color share a point: color_tetrahedra and
+    // the color_block_begin layout
+    void ColorMesh();
+    // Surface of a mesh: tetrahedra faces no other tetrahedra shares, outward, in tetrahedra
+    // order; the lattice links its box faces instead
+    void ExtractSurface();
+    // Rest positions, topology and blocks of Initialize, lattice or mesh
+    void LinkLattice();
+    void LinkMesh();
+    // point_index / lattice_index of Ordering
+    void BuildPointOrder();
+
+    // Corners of blocks [begin, end) into blk[0 .. end - begin) under implicit topology: BoxPerBlock
+    // boxes of the block slab each, j then k order
+    void LatticeBlocks(int begin, int end, TetrahedraBlock* blk) const;
+    // Block b, stored or generated
+    inline void GetBlock(int b, TetrahedraBlock& blk) const {
+        if (implicit_topology) {
+            LatticeBlocks(b, b + 1, &blk);
+        } else {
+            blk = tet_blocks[b];
+        }
+    }
+    // Tetrahedra t, stored or from its box in (i, j, k) order
+    inline TetrahedraType TetrahedraOf(int t) const {
+        if (tetrahedra) return tetrahedra[t];
+        int box = t / TetrahedraPerBox;
+        int i = box / (jNum * kNum), j = box / kNum % jNum, k = box % kNum;
+        int start = (i * (jNum + 1) + j) * (kNum + 1) + k;
+        const int* offset = box_tetrahedra_offset[t % TetrahedraPerBox];
+        return {start + offset[0], start + offset[1], start + offset[2], start + offset[3]};
     }
+    // fn(blocks, first, num) over blocks [begin, end), blocks[0 .. num) being blocks first ..
+    // first + num - 1; returns the combined BlockStats of fn
+    // Under implicit topology the blocks are generated BlockGrain at a time into a stack buffer
+    template <class Fn>
+    inline BlockStats ForBlocks(int begin, int end, const Fn& fn) const {
+        if (!implicit_topology) return fn(tet_blocks.Get() + begin, begin, end - begin);
+        TetrahedraBlock topology[BlockGrain];
+        BlockStats stats = {0.0f, 0.0f};
+        for (int first = begin; first < end; first += BlockGrain) {
+            int num = std::min(BlockGrain, end - first);
+            LatticeBlocks(first, first + num, topology);
+            BlockStats part = fn(topology, first, num);
+            stats.max_strain = std::max(stats.max_strain, part.max_strain);
+            stats.energy += part.energy;
+        }
+        return stats;
+    }
+    // Leave implicit topology: fill tet_blocks, for the passes that read them directly
+    void StoreBlocks();
 
-    inline void GetStrain() {
-        F_deform = T_frame * inv_R_frame;
-        strain = 0.5f * (glm::transpose(F_deform) * F_deform - glm::mat3(1.0f));
+    // Physics
+    //------------------------------------------------------------------------------------------
+    // Health partials of one point chunk
+    struct ChunkHealth {
+        float sum;  // of every position / velocity component, non-finite if any is
+        float max_speed2;
+    };
+    inline void AddHealth(ChunkHealth& health, const glm::vec3& p, const glm::vec3& v) {
+        health.sum += p.x + p.y + p.z + v.x + v.y + v.z;
+        health.max_speed2 = std::max(health.max_speed2, glm::dot(v, v));
+    }
+    // Stats partials of one point chunk, per unit mass, at the start of the step
+    struct ChunkStats {
+        double speed2;
+        glm::dvec3 position;
+        glm::dvec3 velocity;
+        glm::dvec3 moment;  // x * v
+    };
+    template <class T>
+    inline void AddStats(ChunkStats& stats, const glm::vec<3, T>& p, const glm::vec<3, T>& v) {
+        stats.speed2 += glm::dot(v, v);
+        stats.position += glm::dvec3(p);
+        stats.velocity += glm::dvec3(v);
+        stats.moment += glm::dvec3(glm::cross(p, v));
+    }
 
-        // LogMat3("defrom grad", F_deform);
-        // LogMat3("strain", strain);
+    // Mode: state_precision, Gather: sum the force buffer instead of reading acceleration
+    template <PrecisionMode Mode, bool Gather, bool Stats>
+    void UpdatePoints(int chunk, int begin, int end, float dt);
+    template <PrecisionMode Mode>
+    void UpdateChunkOf(int chunk, int begin, int end, float dt);
+    // UpdatePoints of state_precision, the current Assembly and CollectStats
+    void UpdateChunk(int chunk, int begin, int end, float dt);
+    // Move the state to the precision of the next step, allocates the double arrays on first use
+    void SyncPrecision();
+    // Elastic acceleration of blocks [begin, end) into the acceleration of state_precision
+    BlockStats SolveBlockRange(int begin, int end, const KernelParams& params, SolveBlocksFunc solve_blocks);
+    // One step of the current Integrator
+    StepStatus TryStep(float dt);
+    StepStatus IntegrateExplicit(float dt);
+    // Explicit step in one sweep over the points, AssemblyMode::Fused
+    StepStatus StepFused(float dt);
+    // steps explicit steps in about two sweeps over the points, AssemblyMode::Temporal
+    StepStatus StepTemporal(float dt, int steps);
+    // Steps StepTemporal takes at once, 1 when it does not apply
+    int TemporalBatch() const;
+    // Health of the step from chunk_health and step_strain, in Health
+    StepStatus CheckHealth();
+    // Element chunk starting at block begin: keep its elastic energy (over the point mass)
+    inline void SetChunkEnergy(int begin, float energy) {
+        if (CollectStats) chunk_energy[begin] = energy;
+    }
+    // Clear the element partials before the element pass
+    void ResetStats();
+    // Stats from chunk_stats and chunk_energy, with CollectStats
+    void SumStats();
+    // Steps over span from Time, equal and at most max_dt * step_scale; past max_substeps the rest
+    // is dropped. A failed step restores the newest checkpoint and redoes the time from there at
+    // half the scale. Returns the substeps, 0 after AdvanceMaxRollbacks rollbacks
+    int Integrate(float span, float max_dt, int max_substeps);
+    // Checkpoint ring: points, the latest velocity and Time
+    void SaveCheckpoint();
+    void RestoreCheckpoint();
+
+    // Backward Euler step, the system matrix is assembled from the colored blocks
+    StepStatus StepImplicit(float dt);
+    template <class Material>
+    BlockStats AssembleImplicit(int begin, int end, const KernelParams& params, float dt, bool matrix_free);
+    void ApplyImplicit(const glm::vec3* x, glm::vec3* y, const KernelParams& params, float dt);
+
+    // Projective Dynamics step, the global matrix is factored again only if dt or the material change
+    StepStatus StepProjective(float dt);
+    // False if the global matrix is not positive definite
+    bool FactorProjective(float dt);
+    // Add w G^T p of blocks [begin, end) to projective_rhs, p: projection of F onto the constraint set
+    // measure: return the largest TetrahedraStrain2 of the blocks, 0 otherwise
+    float ProjectBlocks(int begin, int end, bool measure);
+    // Constraint weight w = (2 mu + lambda) volume, volume in the units of norm^*
+    inline float ProjectiveWeight(const glm::mat3& inv_R) const {
+        return (2.0f * StressMu + StressLambda) * 0.5f / std::fabs(glm::determinant(inv_R));
     }
 
-    inline void GetStress() {
-        stress = 2.0f * StressMu * strain + StressLambda * Trace(strain) * glm::mat3(1.0f);
-        // LogMat3("stress", stress);
+    inline glm::mat3 GetFrame(int m1, int m2, int m3, int m4) {
+        glm::vec3 p4 = points.Get(m4);
+        return glm::mat3(points.Get(m1) - p4, points.Get(m2) - p4, points.Get(m3) - p4);
     }
 
-    inline void GetForce() {
-        // f_node = -F_deform * stress * norm_with_area;
-        f_node = F_deform * (stress * norm_with_area);
-        // LogVec3("force", f_node);
+    inline glm::vec3 GetNormStar(int m1, int m2, int m3) {
+        glm::vec3 p1 = points.Get(m1);
+        return 0.5f * glm::cross(points.Get(m2) - p1, points.Get(m3) - p1);
     }
 
-    void UpdateParams(float dt) {
-        p_in = 1 - p_in;
-        p_out = 1 - p_in;
-        
-        glm::vec3 avg_a(0.0f);
-        std::string hit_str = "Not Hit";
-        for (int i = 0; i < PointNum; ++i) {
-            glm::vec3& v_in = velocity[p_in * PointNum + i];
-            glm::vec3& v_out = velocity[p_out * PointNum + i];
-
-            // std::cout << "Point: " << i << std::endl;
-            // LogVec3("position", points[i]);
-            // LogVec3("acceleration", acceleration[i]);
-
-            v_out = v_in + (acceleration[i] + ConstantAcceleration) * dt;
-            
-            // Simple damping
-            v_out *= 0.999f;
-
-            // Update Position
-            points[i] += (v_in + v_out) * dt / 2.0f;
-            
-            // Apply Collision to Position & Velocity (Directly Inverse)
-            if (points[i].y < 0.0f) {
-                // hit_str = "Hit";
-                points[i].y = 0.0f;
-                v_out.y = 0.0f;
-            }
-
-            // Log
-            avg_a += acceleration[i];
-            
-        }
-        avg_a /= (float) PointNum;
-        
-        // std::cout << hit_str << std::endl;
-        // LogVec3("Avg. acceleration", avg_a);
-        // LogVec3("Avg. ds", avg_ds);
-        if(std::isnan(avg_a.x) || std::isnan(avg_a.y) || std::isnan(avg_a.z)) {
-            std::cout << "...NaN detected in acceleration" << std::endl;
-            std::cout << "...Exit" << std::endl;
-            exit(-1);
+    // Sum of the force buffer entries of point i, in scatter order
+    inline glm::vec3 GatherAcceleration(int i) const {
+        glm::vec3 a(0.0f);
+        const float* force = tet_force.Get();
+        for (int e = point_adj_begin[i]; e < point_adj_begin[i + 1]; ++e) {
+            const float* fe = force + point_adj[e];
+            a += glm::vec3(fe[0], fe[TetrahedraBlockSize], fe[2 * TetrahedraBlockSize]);
         }
+        return a;
     }
 
     // Utility
@@ -338,10 +467,6 @@ private:
         PutVec3(vn, holder + 15);
     }
 
-    inline float Trace(const glm::mat3& M) {
-        return M[0][0] + M[1][1] + M[2][2];
-    }
-
     template<typename T>
     inline void Inverse(T& x) {x = -x;}
     template<typename T, typename ...Args>
@@ -364,29 +489,103 @@ private:
     // Geometry
     //------------------------------------------------------------------------------------------
     float dL;
-    int iNum, jNum, kNum;
-
-    std::unique_ptr<glm::vec3[]> points;
-    std::unique_ptr<TetrahedraType[]> tetrahedra;
+    int iNum, jNum, kNum;  // 0 for a mesh
+    bool lattice;  // built by the box lattice constructor
+    // Mesh rest positions
+    std::vector<glm::vec3> rest_points;
+
+    Vec3Array points;
+    // Lattice index -> point index and back, of point_ordering
+    PointOrdering point_ordering;
+    std::vector<int> point_index;
+    std::vector<int> lattice_index;
+    std::unique_ptr<TetrahedraType[]> tetrahedra;  // null under implicit topology
+    // Points of the surface in increasing order, surface triangle corners as indices into it
+    std::vector<int> surface_point;
+    std::vector<unsigned int> surface_index;
     std::unique_ptr<SurfaceType[]> surface;
     
     // Physics
     //------------------------------------------------------------------------------------------
-    int p_in, p_out;  // in/out 2 x dimsion
-    std::unique_ptr<glm::vec3[]> velocity;
-    std::unique_ptr<glm::vec3[]> acceleration;
-    std::unique_ptr<glm::mat3[]> inv_R;  // R^-1 rest state per point of tetrahedra
-    std::unique_ptr<glm::vec3[]> norm_star;
-    
-    // Phycical temp var
-    glm::mat3 inv_R_frame;
-    glm::mat3 T_frame;
-    glm::mat3 F_deform;
-    glm::mat3 strain;
-    glm::mat3 stress;
-    glm::vec3 norm_with_area;
-    glm::vec3 f_node;
-    
+    Vec3Array velocity;
+    Vec3Array acceleration;
+    bool acceleration_clear;  // every entry 0: the last point update zeroed what it read
+    // State of Mixed / Double explicit steps, points mirrors points_d; Double also accumulates in
+    // acceleration_d. state_precision: the arrays holding the state, Float past other integrators
+    PrecisionMode state_precision;
+    DVec3Array points_d;
+    DVec3Array velocity_d;
+    DVec3Array acceleration_d;
+    // Tetrahedra blocks, grouped by color: LatticeColorNum box parities of the lattice, ColorMesh
+    // colors of a mesh
+    // Blocks [color_block_begin[c], color_block_begin[c + 1]) share no points
+    int color_num;
+    int tetrahedra_block_num;
+    AlignedArray<TetrahedraBlock> tet_blocks;  // empty under implicit topology
+    // ImplicitTopology of the last Initialize, until StoreBlocks
+    bool implicit_topology;
+    // Corners of box tetrahedra p: box start + box_tetrahedra_offset[p][node]
+    int box_tetrahedra_offset[TetrahedraPerBox][4];
+    // Corners of a block whose boxes are consecutive in k: first box start + block_lane_offset[node][lane]
+    int block_lane_offset[4][TetrahedraBlockSize];
+    // R^-1 and norm^* rest state of the blocks, see CompactRest
+    AlignedArray<TetrahedraRest> tet_rest;
+    std::vector<int> color_block_begin;
+    // Mesh tetrahedra of color c: color_tetrahedra[color_tetrahedra_begin[c] .. color_tetrahedra_begin[c + 1])
+    std::vector<int> color_tetrahedra_begin;
+    std::vector<int> color_tetrahedra;
+    // Blocks of color c in slab i: [slab_block_begin[c * iNum + i], slab_block_begin[c * iNum + i + 1])
+    std::vector<int> slab_block_begin;
+    std::vector<ChunkHealth> chunk_health;  // per point chunk of the last step
+    int point_chunk_num;  // chunks the last point pass used
+    std::atomic<float> step_strain;  // largest strain norm of the last step
+    // Stats partials of the last step, fixed chunks summed in order: same Stats for any thread number
+    std::vector<ChunkStats> chunk_stats;  // per point chunk
+    std::vector<float> chunk_energy;  // per block, set at the first block of each element chunk
+    // Rest shape size for StableTimeStep
+    float min_altitude;
+    float rest_volume;
+    // Step / Advance
+    float step_scale;  // substep over dt / StableTimeStep, halved per rollback
+    // Checkpoint ring, allocated on the first save; age a in slot (checkpoint_newest - a) % size
+    struct Checkpoint {
+        double time;
+        PrecisionMode precision;  // state_precision of the save, double arrays unless Float
+        Vec3Array points;
+        Vec3Array velocity;
+        DVec3Array points_d;
+        DVec3Array velocity_d;
+    };
+    Checkpoint checkpoint[CheckpointRingSize];
+    int checkpoint_newest;
+    int checkpoint_num;
+    int steps_since_checkpoint;
+
+    // Gather assembly
+    // Point i owns force buffer offsets point_adj[point_adj_begin[i] .. point_adj_begin[i + 1])
+    AlignedArray<float> tet_force;
+    std::vector<int> point_adj_begin;
+    std::vector<int> point_adj;
+
+    // Implicit integration, allocated on the first implicit Step
+    BlockCsrMatrix system;  // I - dt^2 K
+    std::vector<int> system_block_index;  // [block][lane][a * 4 + b] -> block of (m(a), m(b))
+    std::vector<glm::mat3> system_inv_diag;
+    // Matrix-free: linearization point per [block][lane]
+    std::vector<glm::mat3> tet_F;
+    std::vector<glm::mat3> tet_stress;
+
+    // Projective Dynamics, factored on the first projective Step
+    // M / dt^2 + sum w G^T G, factored for projective_key = (dt, mu, lambda, mass)
+    SparseCholesky projective_factor;
+    glm::vec4 projective_key;
+    std::vector<glm::vec3> projective_s;  // inertial target x + dt v + dt^2 g
+    std::vector<glm::vec3> projective_x;
+    std::vector<glm::vec3> projective_rhs;
+    std::vector<glm::vec3> implicit_v;
+    std::vector<glm::vec3> implicit_rhs;
+    std::vector<glm::vec3> implicit_dv;
+    CgWorkspace cg_workspace;
 };
 
 }  // namespace model